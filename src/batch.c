@@ -0,0 +1,342 @@
+#include "batch.h"
+#include "dump.h"
+#include "io.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Job lines read and run at a time. Workers claim jobs from a window in
+// order while the main thread prints the finished ones.
+#define BATCH_WINDOW 1024
+
+// Files kept open between jobs. Jobs usually come in runs against the same
+// few files, so reopening them for every job would be wasted work.
+#define BATCH_OPEN_FILES 64
+
+// Bytes read per step by each worker.
+#define BATCH_CHUNK_SIZE (1 << 20)
+
+// Formatted bytes a job buffers while earlier jobs are still printing. A job
+// with more output waits for its turn and then writes straight to the output.
+#define BATCH_TEXT_LIMIT (4 << 20)
+
+// Input bytes formatted between checks of a buffered job's size.
+#define BATCH_TEXT_STEP (64 << 10)
+
+typedef struct {
+  char *path; // NULL if the job line is malformed.
+  uint64_t offset;
+  int64_t length;
+  int line_length;
+  long line_number;
+
+  // Filled in by the worker that runs the job.
+  char *text;
+  size_t text_length;
+  int error;        // errno of the failure, or 0 if the job succeeded.
+  bool read_failed; // Whether the file was opened before the failure.
+  bool streamed;    // Whether the output went straight to the output file.
+  bool done;
+} Job;
+
+typedef struct {
+  FILE *out;
+  bool first; // Whether nothing has been printed yet.
+  Job *jobs;
+  int count;
+  int next;
+  int head; // The job whose output is printed next.
+  FileCache cache;
+  pthread_mutex_t lock;
+  pthread_cond_t finished; // Signalled when a job is done.
+  pthread_cond_t advanced; // Signalled when the head moves on.
+} Batch;
+
+// Waits until job i is the next to print, then prints the text it has
+// buffered so far. The rest of its output can then go straight to the
+// output file.
+static void start_streaming(Batch *batch, Job *job, int i) {
+  pthread_mutex_lock(&batch->lock);
+  while (batch->head != i) {
+    pthread_cond_wait(&batch->advanced, &batch->lock);
+  }
+  pthread_mutex_unlock(&batch->lock);
+
+  if (!batch->first) {
+    fputc('\n', batch->out);
+  }
+  batch->first = false;
+  fwrite(job->text, 1, job->text_length, batch->out);
+  free(job->text);
+  job->text = NULL;
+  job->streamed = true;
+}
+
+// Formats the bytes of job i into a freshly-allocated string, reading
+// through a buffer that the worker reuses from job to job. Once the string
+// outgrows BATCH_TEXT_LIMIT, the job streams its output instead. A job that
+// fails records its error, and produces no text unless it was streaming.
+static void run_job(Batch *batch, int i, uint8_t **buffer,
+                    size_t *buffer_size) {
+  Job *job = &batch->jobs[i];
+  if (job->path == NULL) {
+    return;
+  }
+  OpenFile *file = file_cache_acquire(&batch->cache, job->path);
+  if (file == NULL) {
+    job->error = errno;
+    return;
+  }
+
+  size_t line_length = job->line_length;
+  if (line_length > *buffer_size) {
+    *buffer = realloc(*buffer, line_length);
+    *buffer_size = line_length;
+    if (*buffer == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+  }
+  size_t chunk_size = *buffer_size - *buffer_size % line_length;
+  size_t step = BATCH_TEXT_STEP - BATCH_TEXT_STEP % line_length;
+  step = step > 0 ? step : line_length;
+
+  FILE *mem = open_memstream(&job->text, &job->text_length);
+  if (mem == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  uint64_t pos = job->offset;
+  uint64_t remaining = job->length < 0 ? UINT64_MAX : (uint64_t)job->length;
+  while (remaining > 0) {
+    size_t want = remaining < chunk_size ? remaining : chunk_size;
+    size_t num_bytes;
+    if (!try_read_at(file->fd, *buffer, want, pos, &num_bytes)) {
+      job->error = errno;
+      job->read_failed = true;
+      break;
+    }
+    // Format a buffered job in steps, so that it stops buffering soon
+    // after reaching the limit.
+    for (size_t done = 0; done < num_bytes; done += step) {
+      size_t length = num_bytes - done < step ? num_bytes - done : step;
+      print_lines(job->streamed ? batch->out : mem, *buffer + done, length,
+                  pos + done, line_length);
+      if (!job->streamed && fflush(mem) == 0 &&
+          job->text_length > BATCH_TEXT_LIMIT) {
+        fclose(mem);
+        start_streaming(batch, job, i);
+      }
+    }
+    if (num_bytes < want) {
+      break;
+    }
+    pos += num_bytes;
+    remaining -= num_bytes;
+  }
+  if (!job->streamed) {
+    fclose(mem);
+  }
+  file_cache_release(&batch->cache, file);
+  if (job->error != 0) {
+    free(job->text);
+    job->text = NULL;
+  }
+}
+
+static void *batch_worker(void *arg) {
+  Batch *batch = (Batch *)arg;
+  size_t buffer_size = BATCH_CHUNK_SIZE;
+  uint8_t *buffer = malloc(buffer_size);
+  if (buffer == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  while (true) {
+    int i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+    if (i >= batch->count) {
+      break;
+    }
+    run_job(batch, i, &buffer, &buffer_size);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->jobs[i].done = true;
+    pthread_cond_broadcast(&batch->finished);
+    pthread_mutex_unlock(&batch->lock);
+  }
+
+  free(buffer);
+  return NULL;
+}
+
+int parse_job_line(char *line, char **path, uint64_t *offset,
+                   int64_t *length, int *line_length) {
+  char *fields[5];
+  int count = 0;
+  char *save;
+  for (char *field = strtok_r(line, " \t\r\n", &save); field != NULL;
+       field = strtok_r(NULL, " \t\r\n", &save)) {
+    if (count == 0 && field[0] == '#') {
+      return 0;
+    }
+    if (count < 5) {
+      fields[count] = field;
+    }
+    count++;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  int64_t start, width = *line_length;
+  *length = -1;
+  bool ok = (count == 3 || count == 4) && try_parse_size(fields[1], &start) &&
+            start >= 0 &&
+            (strcmp(fields[2], "-") == 0 ||
+             (try_parse_size(fields[2], length) && *length >= -1)) &&
+            (count == 3 || (try_parse_size(fields[3], &width) && width > 0 &&
+                            width <= INT_MAX));
+  if (!ok) {
+    return -1;
+  }
+  *path = fields[0];
+  *offset = start;
+  *line_length = (int)width;
+  return 1;
+}
+
+// Parses one job line into *job. Returns false for blank and comment lines.
+// A malformed line gives a job without a path, reported when its turn comes.
+static bool parse_job(char *line, long line_number, int line_length,
+                      Job *job) {
+  char *path;
+  *job = (Job){NULL, 0, -1, line_length, line_number, NULL, 0, 0,
+               false, false, false};
+  int found = parse_job_line(line, &path, &job->offset, &job->length,
+                             &job->line_length);
+  if (found < 0) {
+    return true;
+  }
+  if (found == 0) {
+    return false;
+  }
+
+  job->path = strdup(path);
+  if (job->path == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  return true;
+}
+
+// Runs a window of jobs and prints their output in order. Returns the number
+// of jobs that failed.
+static int run_window(Batch *batch, Job *jobs, int count, int threads) {
+  batch->jobs = jobs;
+  batch->count = count;
+  batch->next = 0;
+  batch->head = 0;
+
+  threads = threads < count ? threads : count;
+  pthread_t *workers = malloc(sizeof(pthread_t) * (threads > 0 ? threads : 1));
+  if (workers == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&workers[i], NULL, batch_worker, batch) != 0) {
+      fprintf(stderr, "Error: Could not start worker thread\n");
+      exit(1);
+    }
+  }
+
+  FILE *out = batch->out;
+  int failures = 0;
+  for (int i = 0; i < count; i++) {
+    pthread_mutex_lock(&batch->lock);
+    batch->head = i;
+    pthread_cond_broadcast(&batch->advanced);
+    while (!jobs[i].done) {
+      pthread_cond_wait(&batch->finished, &batch->lock);
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (jobs[i].path == NULL) {
+      fflush(out);
+      fprintf(stderr, "Error: Invalid job on line %ld\n", jobs[i].line_number);
+      failures++;
+    } else if (jobs[i].error != 0) {
+      fflush(out);
+      fprintf(stderr, "Error: Could not %s file '%s': %s\n",
+              jobs[i].read_failed ? "read" : "open", jobs[i].path,
+              strerror(jobs[i].error));
+      failures++;
+    } else if (!jobs[i].streamed) {
+      if (!batch->first) {
+        fputc('\n', out);
+      }
+      batch->first = false;
+      fwrite(jobs[i].text, 1, jobs[i].text_length, out);
+    }
+    free(jobs[i].text);
+    free(jobs[i].path);
+  }
+
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+  return failures;
+}
+
+int dump_batch_jobs(FILE *out, FILE *jobs, int line_length, int threads) {
+  Batch batch;
+  memset(&batch, 0, sizeof(batch));
+  file_cache_init(&batch.cache, BATCH_OPEN_FILES);
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.finished, NULL);
+  pthread_cond_init(&batch.advanced, NULL);
+  batch.out = out;
+  batch.first = true;
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  Job *window = malloc(sizeof(Job) * BATCH_WINDOW);
+  if (window == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  char *line = NULL;
+  size_t capacity = 0;
+  long line_number = 0;
+  bool more = true;
+  int failures = 0;
+  while (more) {
+    int count = 0;
+    while (count < BATCH_WINDOW) {
+      if (getline(&line, &capacity, jobs) < 0) {
+        more = false;
+        break;
+      }
+      line_number++;
+      count += parse_job(line, line_number, line_length, &window[count]);
+    }
+    failures += run_window(&batch, window, count, threads);
+  }
+
+  file_cache_destroy(&batch.cache);
+  pthread_mutex_destroy(&batch.lock);
+  pthread_cond_destroy(&batch.finished);
+  pthread_cond_destroy(&batch.advanced);
+  free(window);
+  free(line);
+  return failures;
+}
@@ -0,0 +1,29 @@
+#ifndef batch_h
+#define batch_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Runs every dump job listed in `jobs`, one per line, in the form
+//
+//   <path> <offset> <length> [<line_length>]
+//
+// where the sizes use the usual size syntax and a length of - dumps to the
+// end of the file. Blank lines and lines starting with # are ignored. Jobs
+// are formatted in parallel on `threads` threads, sharing a cache of open
+// files, and each job's output is written to `out` contiguously and in the
+// order given, separated by blank lines. Jobs with a lot of output write it
+// as they go once earlier jobs are done, so memory use stays bounded. A
+// malformed job line, or a job whose file cannot be opened or read, or is
+// not a regular file or block device, is reported on stderr without
+// stopping the others. Returns the number of jobs that failed.
+int dump_batch_jobs(FILE *out, FILE *jobs, int line_length, int threads);
+
+// Splits a job line into its fields, leaving *line_length unchanged if the
+// line does not give one. *path points into the line, which is modified.
+// Returns 1 for a job, 0 for a blank or comment line and -1 if the line is
+// malformed.
+int parse_job_line(char *line, char **path, uint64_t *offset,
+                   int64_t *length, int *line_length);
+
+#endif
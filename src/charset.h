@@ -0,0 +1,19 @@
+#ifndef charset_h
+#define charset_h
+
+#include <stdint.h>
+
+// Character sets for the text column.
+typedef enum {
+  CHARSET_ASCII,
+  CHARSET_LATIN1, // ISO 8859-1.
+  CHARSET_EBCDIC, // Code page 037.
+  CHARSET_CP437,  // The IBM PC character set, including its glyphs for
+                  // control bytes.
+} Charset;
+
+// Returns the Unicode code point shown for each of the 256 byte values in
+// the character set, with 0 for bytes that have no visible character.
+const uint16_t *charset_code_points(Charset charset);
+
+#endif
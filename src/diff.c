@@ -0,0 +1,508 @@
+#include "diff.h"
+#include "format.h"
+#include "hash.h"
+#include "io.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes compared per read. Identical blocks are skipped with a single memcmp
+// (which glibc vectorizes), so only blocks holding a difference are ever
+// split into lines and formatted.
+#define DIFF_BLOCK_SIZE (1 << 20)
+
+// Bytes per hashed window when realigning shifted inputs. A realignment
+// needs at least this many identical bytes in a row.
+#define ALIGN_WINDOW 32
+
+// Bytes buffered from each input. A realignment is searched for in the next
+// ALIGN_SEARCH / 2 to ALIGN_SEARCH bytes of both inputs, so this also bounds
+// the largest insertion or deletion that can be recognised as such.
+#define ALIGN_SEARCH (16 << 20)
+
+// Number of recent insertions and deletions remembered to detect moves.
+#define ALIGN_RECENT 64
+
+void print_diff_side(uint8_t *bytes, int num_bytes, uint8_t *other,
+                     int other_bytes, int line_length) {
+  for (int i = 0; i < line_length; i++) {
+    if (i > 0 && i % 4 == 0) {
+      printf(" ");
+    }
+    if (i >= num_bytes) {
+      printf("   ");
+    } else if (i >= other_bytes || bytes[i] != other[i]) {
+      printf("\033[0;31m %02X\033[0m", bytes[i]);
+    } else {
+      printf(" %02X", bytes[i]);
+    }
+  }
+
+  printf(" | ");
+
+  for (int i = 0; i < line_length; i++) {
+    if (i >= num_bytes) {
+      printf(" ");
+      continue;
+    }
+    char glyph[GLYPH_MAX];
+    int length = put_char(glyph, bytes[i]) - glyph;
+    if (i >= other_bytes || bytes[i] != other[i]) {
+      printf("\033[0;31m%.*s\033[0m", length, glyph);
+    } else {
+      printf("%.*s", length, glyph);
+    }
+  }
+}
+
+static void print_diff_line(uint8_t *line_a, int bytes_a, uint8_t *line_b,
+                            int bytes_b, uint64_t offset, int line_length) {
+  printf("\033[0;33m%08llx\033[0m ", (unsigned long long)offset);
+  print_diff_side(line_a, bytes_a, line_b, bytes_b, line_length);
+  printf("  ");
+  print_diff_side(line_b, bytes_b, line_a, bytes_a, line_length);
+  printf("\n");
+}
+
+long long diff_files(FILE *file_a, FILE *file_b, uint64_t offset,
+                     int64_t bytes_to_read, int line_length) {
+  // Keep blocks a whole number of lines long so line offsets stay aligned.
+  size_t block_size = DIFF_BLOCK_SIZE - DIFF_BLOCK_SIZE % line_length;
+  if (block_size == 0) {
+    block_size = line_length;
+  }
+
+  uint8_t *buffer_a = (uint8_t *)malloc(block_size);
+  uint8_t *buffer_b = (uint8_t *)malloc(block_size);
+  if (buffer_a == NULL || buffer_b == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  long long differing_lines = 0;
+  bool a_done = false;
+  bool b_done = false;
+
+  while (!(a_done && b_done) && bytes_to_read != 0) {
+    size_t max_bytes = block_size;
+    if (bytes_to_read > 0 && (uint64_t)bytes_to_read < block_size) {
+      max_bytes = bytes_to_read;
+    }
+
+    size_t num_a = a_done ? 0 : fread(buffer_a, 1, max_bytes, file_a);
+    size_t num_b = b_done ? 0 : fread(buffer_b, 1, max_bytes, file_b);
+    a_done = a_done || num_a < max_bytes;
+    b_done = b_done || num_b < max_bytes;
+
+    size_t num_bytes = num_a > num_b ? num_a : num_b;
+    if (num_bytes == 0) {
+      break;
+    }
+
+    if (num_a != num_b || memcmp(buffer_a, buffer_b, num_bytes) != 0) {
+      for (size_t pos = 0; pos < num_bytes; pos += line_length) {
+        int line_a = pos < num_a ? (int)(num_a - pos) : 0;
+        int line_b = pos < num_b ? (int)(num_b - pos) : 0;
+        line_a = line_a < line_length ? line_a : line_length;
+        line_b = line_b < line_length ? line_b : line_length;
+
+        if (line_a == line_b &&
+            memcmp(buffer_a + pos, buffer_b + pos, line_a) == 0) {
+          continue;
+        }
+        print_diff_line(buffer_a + pos, line_a, buffer_b + pos, line_b,
+                        offset + pos, line_length);
+        differing_lines++;
+      }
+    }
+
+    offset += num_bytes;
+    if (bytes_to_read > 0) {
+      bytes_to_read -= num_bytes;
+    }
+  }
+
+  free(buffer_a);
+  free(buffer_b);
+  return differing_lines;
+}
+
+/* ------------------------------------- */
+/* Aligned diff: shift-tolerant compare. */
+/* ------------------------------------- */
+
+// A sliding read buffer over one input.
+typedef struct {
+  int fd;
+  uint64_t base;  // File position of data[0].
+  size_t length;  // Number of valid bytes in data.
+  uint64_t limit; // Position at which the input is treated as ended.
+  bool eof;
+  uint8_t *data;
+} Window;
+
+// An insertion or deletion that may turn out to be half of a move.
+typedef struct {
+  char side;
+  uint64_t offset;
+  uint64_t length;
+  uint64_t hash;
+  long long hunk;
+} Change;
+
+// A hunk found to be half of a move by the first pass. Only the half that
+// comes first is reported, with the offset of the other half.
+typedef struct {
+  long long hunk;
+  bool first;
+  uint64_t other;
+} MoveHalf;
+
+typedef struct {
+  Window a;
+  Window b;
+  int line_length;
+  int32_t *heads;
+  int32_t *next;
+  Change recent[ALIGN_RECENT];
+  int recent_count;
+  bool printing;  // False during the first pass, which only finds moves.
+  long long hunks;
+  MoveHalf *moves;
+  size_t move_count;
+  size_t move_capacity;
+  size_t next_move;
+  long long ranges;
+} Aligner;
+
+// Returns a pointer to the buffered data at pos and stores the number of
+// bytes available there in *avail. The buffer is only refilled once fewer
+// than half of its capacity remains ahead of pos.
+static uint8_t *window_at(Window *w, uint64_t pos, size_t *avail) {
+  bool in_window = pos >= w->base && pos <= w->base + w->length;
+  size_t ahead = in_window ? w->base + w->length - pos : 0;
+
+  if (!in_window || (ahead < ALIGN_SEARCH / 2 && !w->eof)) {
+    if (in_window) {
+      memmove(w->data, w->data + (pos - w->base), ahead);
+    } else {
+      ahead = 0;
+    }
+    w->base = pos;
+    size_t want = ALIGN_SEARCH - ahead;
+    if (w->limit - (pos + ahead) < want) {
+      want = w->limit - (pos + ahead);
+    }
+    size_t got = read_at(w->fd, w->data + ahead, want, pos + ahead);
+    w->length = ahead + got;
+    w->eof = got < want || pos + w->length >= w->limit;
+    ahead = w->length;
+  }
+
+  *avail = ahead;
+  return w->data + (pos - w->base);
+}
+
+// Returns the length of the common prefix of a and b.
+static size_t common_prefix(const uint8_t *a, const uint8_t *b, size_t n) {
+  size_t pos = 0;
+  while (pos + 4096 <= n && memcmp(a + pos, b + pos, 4096) == 0) {
+    pos += 4096;
+  }
+  while (pos < n && a[pos] == b[pos]) {
+    pos++;
+  }
+  return pos;
+}
+
+static void print_offset_column(uint64_t offset, bool present) {
+  if (present) {
+    printf("\033[0;33m%08llx\033[0m ", (unsigned long long)offset);
+  } else {
+    printf("%9s", "");
+  }
+}
+
+// Dumps a pair of ranges side by side, each with its own offsets.
+static void print_hunk_body(uint8_t *a, uint64_t len_a, uint64_t offset_a,
+                            uint8_t *b, uint64_t len_b, uint64_t offset_b,
+                            int line_length) {
+  uint64_t len = len_a > len_b ? len_a : len_b;
+  for (uint64_t pos = 0; pos < len; pos += line_length) {
+    int line_a = pos < len_a ? (int)(len_a - pos < (uint64_t)line_length
+                                         ? len_a - pos
+                                         : (uint64_t)line_length)
+                             : 0;
+    int line_b = pos < len_b ? (int)(len_b - pos < (uint64_t)line_length
+                                         ? len_b - pos
+                                         : (uint64_t)line_length)
+                             : 0;
+    print_offset_column(offset_a + pos, line_a > 0);
+    print_diff_side(a + pos, line_a, b + pos, line_b, line_length);
+    printf("  ");
+    print_offset_column(offset_b + pos, line_b > 0);
+    print_diff_side(b + pos, line_b, a + pos, line_a, line_length);
+    printf("\n");
+  }
+}
+
+static void print_hunk_header(uint64_t offset_a, uint64_t len_a,
+                              uint64_t offset_b, uint64_t len_b,
+                              const char *kind) {
+  printf("\033[0;36m@@ -%llx,%llu +%llx,%llu @@ %s\033[0m\n",
+         (unsigned long long)offset_a, (unsigned long long)len_a,
+         (unsigned long long)offset_b, (unsigned long long)len_b, kind);
+}
+
+// Checks whether a pure insertion or deletion undoes an earlier one, i.e.
+// whether the bytes were moved. Otherwise remembers it for later checks.
+static bool match_move(Aligner *al, char side, uint64_t offset, uint8_t *data,
+                       uint64_t length, long long hunk, Change *counterpart) {
+  if (length < ALIGN_WINDOW) {
+    return false;
+  }
+
+  uint64_t hash = hash64(data, length, 0);
+  for (int i = 0; i < al->recent_count; i++) {
+    Change *c = &al->recent[i];
+    if (c->side != side && c->length == length && c->hash == hash) {
+      *counterpart = *c;
+      al->recent[i] = al->recent[--al->recent_count];
+      return true;
+    }
+  }
+
+  if (al->recent_count == ALIGN_RECENT) {
+    memmove(al->recent, al->recent + 1, sizeof(Change) * (ALIGN_RECENT - 1));
+    al->recent_count--;
+  }
+  al->recent[al->recent_count++] = (Change){side, offset, length, hash, hunk};
+  return false;
+}
+
+static void add_move(Aligner *al, long long hunk, bool first, uint64_t other) {
+  if (al->move_count == al->move_capacity) {
+    al->move_capacity = al->move_capacity ? al->move_capacity * 2 : 16;
+    al->moves = realloc(al->moves, sizeof(MoveHalf) * al->move_capacity);
+    if (al->moves == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+  }
+  al->moves[al->move_count++] = (MoveHalf){hunk, first, other};
+}
+
+static int compare_moves(const void *x, const void *y) {
+  long long a = ((const MoveHalf *)x)->hunk;
+  long long b = ((const MoveHalf *)y)->hunk;
+  return (a > b) - (a < b);
+}
+
+// Reports the ranges a[0, len_a) and b[0, len_b), which are fully buffered.
+// The first pass only pairs up moves; the second one prints each hunk, or
+// just the header of a move at its first half.
+static void emit_hunk(Aligner *al, uint8_t *a, uint64_t len_a, uint8_t *b,
+                      uint64_t len_b, uint64_t offset_a, uint64_t offset_b) {
+  long long hunk = al->hunks++;
+
+  if (!al->printing) {
+    Change other;
+    if (len_a == 0 && match_move(al, 'b', offset_b, b, len_b, hunk, &other)) {
+      add_move(al, other.hunk, true, offset_b);
+      add_move(al, hunk, false, other.offset);
+    } else if (len_b == 0 &&
+               match_move(al, 'a', offset_a, a, len_a, hunk, &other)) {
+      add_move(al, other.hunk, true, offset_a);
+      add_move(al, hunk, false, other.offset);
+    }
+    return;
+  }
+
+  if (al->next_move < al->move_count &&
+      al->moves[al->next_move].hunk == hunk) {
+    MoveHalf *move = &al->moves[al->next_move++];
+    if (!move->first) {
+      return;
+    }
+    al->ranges++;
+    if (len_a == 0) {
+      print_hunk_header(move->other, len_b, offset_b, len_b, "moved");
+    } else {
+      print_hunk_header(offset_a, len_a, move->other, len_a, "moved");
+    }
+    return;
+  }
+
+  al->ranges++;
+  const char *kind = len_a == 0 ? "inserted" : len_b == 0 ? "deleted"
+                                                          : "changed";
+  print_hunk_header(offset_a, len_a, offset_b, len_b, kind);
+  print_hunk_body(a, len_a, offset_a, b, len_b, offset_b, al->line_length);
+}
+
+// Reports everything left in one input after the other one has ended.
+static void emit_tail(Aligner *al, Window *w, uint64_t pos, bool is_a,
+                      uint64_t other_pos) {
+  uint64_t end = w->limit;
+  uint64_t size;
+  if (input_size(w->fd, &size) && size < end) {
+    end = size;
+  }
+  if (!al->printing || pos >= end) {
+    return;
+  }
+
+  al->ranges++;
+  uint64_t length = end - pos;
+  if (is_a) {
+    print_hunk_header(pos, length, other_pos, 0, "deleted");
+  } else {
+    print_hunk_header(other_pos, 0, pos, length, "inserted");
+  }
+
+  size_t avail;
+  uint8_t *data;
+  while (pos < end && (data = window_at(w, pos, &avail), avail > 0)) {
+    if (is_a) {
+      print_hunk_body(data, avail, pos, data, 0, 0, al->line_length);
+    } else {
+      print_hunk_body(data, 0, 0, data, avail, pos, al->line_length);
+    }
+    pos += avail;
+  }
+}
+
+// Searches for the earliest position in b whose next ALIGN_WINDOW bytes match
+// a window-aligned block of a. On success the match is extended backwards and
+// the realignment point is stored in *qa and *qb.
+static bool find_resync(Aligner *al, uint8_t *a, size_t len_a, uint8_t *b,
+                        size_t len_b, size_t *qa, size_t *qb) {
+  if (len_a < ALIGN_WINDOW || len_b < ALIGN_WINDOW) {
+    return false;
+  }
+
+  size_t windows = len_a / ALIGN_WINDOW;
+  size_t buckets = 1024;
+  while (buckets < windows * 2) {
+    buckets *= 2;
+  }
+  uint32_t mask = buckets - 1;
+  memset(al->heads, 0xff, sizeof(int32_t) * buckets);
+
+  // Insert in reverse so that each chain lists its earliest window first.
+  RollSum sum;
+  for (size_t k = windows; k-- > 0;) {
+    rollsum_init(&sum, a + k * ALIGN_WINDOW, ALIGN_WINDOW);
+    uint32_t h = rollsum_digest(&sum) & mask;
+    al->next[k] = al->heads[h];
+    al->heads[h] = (int32_t)k;
+  }
+
+  rollsum_init(&sum, b, ALIGN_WINDOW);
+  for (size_t j = 0;; j++) {
+    uint32_t h = rollsum_digest(&sum) & mask;
+    for (int32_t k = al->heads[h]; k >= 0; k = al->next[k]) {
+      uint8_t *block = a + (size_t)k * ALIGN_WINDOW;
+      if (memcmp(block, b + j, ALIGN_WINDOW) == 0) {
+        size_t i = (size_t)k * ALIGN_WINDOW;
+        while (i > 0 && j > 0 && a[i - 1] == b[j - 1]) {
+          i--;
+          j--;
+        }
+        *qa = i;
+        *qb = j;
+        return true;
+      }
+    }
+    if (j + ALIGN_WINDOW >= len_b) {
+      return false;
+    }
+    rollsum_roll(&sum, b[j], b[j + ALIGN_WINDOW]);
+  }
+}
+
+// Walks both inputs from offset, reporting every hunk to emit_hunk.
+static void align_inputs(Aligner *al, uint64_t offset) {
+  uint64_t pos_a = offset;
+  uint64_t pos_b = offset;
+  al->a.base = al->b.base = offset;
+  al->a.length = al->b.length = 0;
+  al->a.eof = al->b.eof = false;
+  al->hunks = 0;
+
+  while (true) {
+    size_t len_a, len_b;
+    uint8_t *a = window_at(&al->a, pos_a, &len_a);
+    uint8_t *b = window_at(&al->b, pos_b, &len_b);
+
+    if (len_a == 0) {
+      emit_tail(al, &al->b, pos_b, false, pos_a);
+      break;
+    }
+    if (len_b == 0) {
+      emit_tail(al, &al->a, pos_a, true, pos_b);
+      break;
+    }
+
+    size_t same = common_prefix(a, b, len_a < len_b ? len_a : len_b);
+    if (same > 0) {
+      pos_a += same;
+      pos_b += same;
+      continue;
+    }
+
+    // Look for a realignment close by first, widening the search only if
+    // none is found, so that small edits stay cheap to resolve.
+    size_t qa, qb;
+    bool found = false;
+    for (size_t span = 4096; !found; span *= 64) {
+      size_t span_a = span < len_a ? span : len_a;
+      size_t span_b = span < len_b ? span : len_b;
+      found = find_resync(al, a, span_a, b, span_b, &qa, &qb);
+      if (span_a == len_a && span_b == len_b) {
+        break;
+      }
+    }
+
+    if (!found) {
+      qa = len_a;
+      qb = len_b;
+    }
+    emit_hunk(al, a, qa, b, qb, pos_a, pos_b);
+    pos_a += qa;
+    pos_b += qb;
+  }
+}
+
+long long diff_aligned(int fd_a, int fd_b, uint64_t offset,
+                       int64_t bytes_to_read, int line_length) {
+  uint64_t limit = bytes_to_read < 0 ? UINT64_MAX : offset + bytes_to_read;
+  Aligner al = {
+      .a = {fd_a, offset, 0, limit, false, malloc(ALIGN_SEARCH)},
+      .b = {fd_b, offset, 0, limit, false, malloc(ALIGN_SEARCH)},
+      .line_length = line_length,
+      .heads = malloc(sizeof(int32_t) * (ALIGN_SEARCH / ALIGN_WINDOW) * 2),
+      .next = malloc(sizeof(int32_t) * (ALIGN_SEARCH / ALIGN_WINDOW)),
+  };
+  if (al.a.data == NULL || al.b.data == NULL || al.heads == NULL ||
+      al.next == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  // A move is only recognised at its second half, so the inputs are aligned
+  // twice: once to pair up moves, and once to print with that knowledge.
+  align_inputs(&al, offset);
+  qsort(al.moves, al.move_count, sizeof(MoveHalf), compare_moves);
+  al.printing = true;
+  align_inputs(&al, offset);
+
+  free(al.a.data);
+  free(al.b.data);
+  free(al.heads);
+  free(al.next);
+  free(al.moves);
+  return al.ranges;
+}
@@ -0,0 +1,27 @@
+#ifndef diff_h
+#define diff_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Prints one side of a diff line: the hex bytes followed by their ASCII
+// representation. Bytes that differ from the other side are shown in red.
+void print_diff_side(uint8_t *bytes, int num_bytes, uint8_t *other,
+                     int other_bytes, int line_length);
+
+// Compares two inputs in lockstep, starting at their current positions, and
+// prints the lines that differ side by side with the changed bytes
+// highlighted. A negative bytes_to_read compares until both inputs end.
+// Returns the number of differing lines.
+long long diff_files(FILE *file_a, FILE *file_b, uint64_t offset,
+                     int64_t bytes_to_read, int line_length);
+
+// Compares two seekable files while tolerating inserted and deleted bytes.
+// After each mismatch the inputs are realigned by matching rolling-hash
+// windows of one file against the other, and the inserted, deleted, changed
+// and moved ranges are reported with only their bytes dumped. Memory use is
+// bounded by the realignment search window. Returns the number of ranges.
+long long diff_aligned(int fd_a, int fd_b, uint64_t offset,
+                       int64_t bytes_to_read, int line_length);
+
+#endif
@@ -1,81 +1,757 @@
 #include "args.h"
+#include "batch.h"
+#include "charset.h"
+#include "diff.h"
+#include "dump.h"
+#include "format.h"
+#include "highlight.h"
+#include "follow.h"
+#include "incremental.h"
+#include "io.h"
+#include "live.h"
+#include "ranges.h"
+#include "record.h"
+#include "serve.h"
+#include "stride.h"
+#include "terminal.h"
+#include "merkle.h"
+#include "pager.h"
+#include "vote.h"
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Number of samples gathered before they are read and printed.
+#define SAMPLE_BATCH 4096
 
 char *helptext =
     "Usage: hexdump [file]\n"
+    "       hexdump --diff|--align <file1> <file2>\n"
+    "       hexdump --vote <file1> <file2> <file3>...\n"
+    "       hexdump --batch <jobfile>\n"
+    "       hexdump --pager <file>\n"
+    "       hexdump <command> [args]\n"
     "\n"
     "Arguments:\n"
     "  [file]              File to read (default: STDIN).\n"
     "\n"
     "Options:\n"
-    "  -l, --line <int>    Bytes per line in output (default: 16).\n"
-    "  -n, --num <int>     Number of bytes to read (default: all).\n"
-    "  -o, --offset <int>  Byte offset at which to begin reading.\n"
+    "  Sizes accept a 0x prefix and K, M, G or T suffixes, e.g. 64K.\n"
+    "  -l, --line <int>    Bytes per line in output (default: 16). 'auto'\n"
+    "                      fits the lines to the terminal width.\n"
+    "  -g, --group <int>   Print the hex bytes as words of 1, 2, 4 or 8\n"
+    "                      bytes (default: 1).\n"
+    "  --endian <order>    Byte order of the words, little or big\n"
+    "                      (default: little).\n"
+    "  -r, --radix <name>  Print the units as hex, oct, dec (unsigned),\n"
+    "                      sdec (signed) or bin (default: hex).\n"
+    "  --as <type>         Print the bytes as values of a type: u8, i8,\n"
+    "                      u16, i16, u32, i32, u64, i64, f32 or f64.\n"
+    "  --colour <scheme>   Colour the bytes by the default scheme or by\n"
+    "                      class: NUL, printable, whitespace, control and\n"
+    "                      high-bit bytes.\n"
+    "  --highlight <rule>  Highlight byte values (0xff, 0x80-0xff), offset\n"
+    "                      ranges (@<start>:<len>) or the matches of a text\n"
+    "                      or hex search (/text, /0x0d0a). Repeatable.\n"
+    "  --charset <name>    Character set of the text column: ascii,\n"
+    "                      latin1, ebcdic or cp437 (default: ascii).\n"
+    "  -n, --num <size>    Number of bytes to read (default: all).\n"
+    "  -o, --offset <size> Byte offset at which to begin reading. Negative\n"
+    "                      offsets count back from the end of the input.\n"
+    "                      Pipes are skipped through without seeking.\n"
+    "  -e, --format <spec> Print each line with a hexdump-style layout, e.g.\n"
+    "                      '\"%_ax: \" 8/2 \"%04x \" \"\\n\"'. Units of 1, 2, 4\n"
+    "                      or 8 bytes; conversions %x %X %o %d %u %c.\n"
+    "  --tail <size>       Dump only the last <size> bytes of the input.\n"
+    "  --range <start:len> Dump <len> bytes from offset <start>. Repeat to\n"
+    "                      dump many regions of a file in one run.\n"
+    "  --sample <size>     Dump one line every <size> bytes, reading only\n"
+    "                      the sampled bytes. Also --stride.\n"
+    "  --sample-size <size>\n"
+    "                      Bytes per sample (default: one line).\n"
+    "  --batch <path>      Run many dumps in one process. Each line of the\n"
+    "                      file (- for STDIN) is a job of the form\n"
+    "                      `<file> <offset> <length> [<line>]`.\n"
+    "  --pager             Browse the file interactively, formatting only\n"
+    "                      the lines on screen. Keys: arrows, j/k, space/b,\n"
+    "                      g/G, o (jump to offset), / and ? (search text,\n"
+    "                      or hex bytes after 0x), n/N, q.\n"
+    "  --record <path>     Print the input as a table of fixed-size records\n"
+    "                      described by a layout file, one field per line:\n"
+    "                      `<name> <type> [@<offset>] [little|big]`.\n"
+    "  -f, --follow        After the end of the file, wait for it to grow\n"
+    "                      and dump the new bytes, like `tail -f`.\n"
+    "  --live              Dump data as soon as it arrives, flushing after\n"
+    "                      every chunk, for serial ports, sockets and pipes.\n"
+    "  -t, --timestamp     With --live, prefix each chunk with the time\n"
+    "                      elapsed since the dump started.\n"
+    "  --state <path>      Only dump the lines of blocks that changed since\n"
+    "                      the previous run with the same state file.\n"
+    "  --cache <path>      With --state, print the full dump, reusing the\n"
+    "                      previous run's output for unchanged blocks.\n"
+    "  --max-stride <int>  Longest record length tried by --detect-stride\n"
+    "                      (default: 1024).\n"
+    "  -j, --threads <int> Threads for hashing with --state, reading with\n"
+    "                      --range, running --batch jobs and detecting\n"
+    "                      strides (default: one per CPU).\n"
     "\n"
     "Flags:\n"
+    "  --diff              Compare two files and print only the lines that\n"
+    "                      differ, side by side. Exits 1 if they differ.\n"
+    "  --align             Like --diff, but realigns the files after inserted\n"
+    "                      or deleted bytes and reports the changed ranges.\n"
+    "  --vote              Compare three or more replicas in one pass and\n"
+    "                      print the lines where they disagree along with\n"
+    "                      the majority value. Exits 1 if they disagree.\n"
+    "  --detect-stride     Estimate the record length of the input by\n"
+    "                      autocorrelation and suggest a line length.\n"
     "  -h, --help          Display this help text and exit.\n"
-    "  -v, --version       Display the version number and exit.\n";
+    "  -v, --version       Display the version number and exit.\n"
+    "\n"
+    "Commands:\n"
+    "  index               Build a Merkle-tree index of a file's blocks.\n"
+    "  compare             Compare two files using their indexes.\n"
+    "  serve               Answer dump requests on a Unix domain socket.\n"
+    "  help <command>      Display a command's help text and exit.\n";
+
+char *index_helptext =
+    "Usage: hexdump index <file>...\n"
+    "\n"
+    "  Hashes the file's blocks in parallel and writes a Merkle tree of the\n"
+    "  hashes to a sidecar file named <file>.dmpidx.\n"
+    "\n"
+    "Options:\n"
+    "  -b, --block <int>    Bytes per hashed block (default: 1048576).\n"
+    "  -j, --threads <int>  Hashing threads (default: one per CPU).\n";
+
+char *compare_helptext =
+    "Usage: hexdump compare <file1> <file2>\n"
+    "\n"
+    "  Compares two files by walking their Merkle-tree indexes, descending\n"
+    "  only into subtrees whose hashes differ, then prints the differing\n"
+    "  lines of the differing blocks side by side. Missing or out-of-date\n"
+    "  indexes are rebuilt first. Exits 1 if the files differ.\n"
+    "\n"
+    "Options:\n"
+    "  -b, --block <int>    Bytes per hashed block (default: 1048576).\n"
+    "  -j, --threads <int>  Hashing threads (default: one per CPU).\n"
+    "  -l, --line <int>     Bytes per line in output (default: 16).\n";
+
+char *serve_helptext =
+    "Usage: hexdump serve <socket>\n"
+    "\n"
+    "  Listens on a Unix domain socket and answers dump requests until\n"
+    "  killed. Each request is a line of the form\n"
+    "\n"
+    "    <file> <offset> <length> [<line>]\n"
+    "\n"
+    "  as with --batch. The reply is the dump in frames of a length line\n"
+    "  followed by that many bytes, ending with a frame of length 0, or a\n"
+    "  single line starting with '!' if the request failed. Recently used\n"
+    "  files are kept open between requests.\n"
+    "\n"
+    "Options:\n"
+    "  -l, --line <int>     Default bytes per line (default: 16).\n"
+    "  -m, --files <int>    Files kept open (default: 16).\n";
+
+// Parses a byte count, exiting with an error message on failure.
+int64_t parse_size(const char *string) {
+  int64_t value;
+  if (!try_parse_size(string, &value)) {
+    fprintf(stderr, "Error: Cannot parse '%s' as a byte count\n", string);
+    exit(1);
+  }
+  return value;
+}
 
-void print_line(uint8_t *buffer, int num_bytes, int offset, int line_length) {
-  printf("\033[0;33m%08x\033[0m ",
-         offset); // Print the offset in hexadecimal format in yellow color
+// Returns the byte count given for an option, or the fallback if the option
+// was not found.
+int64_t size_value(ArgParser *parser, const char *name, int64_t fallback) {
+  return ap_found(parser, name) ? parse_size(ap_str_value(parser, name))
+                                : fallback;
+}
 
-  for (int i = 0; i < line_length; i++) {
-    if (i > 0 && i % 4 == 0) {
-      printf(" ");
+// Returns the line length given with -l. 'auto' picks the longest line for
+// which `panes` dumps side by side fit the width of the terminal, or the
+// default if the output is not a terminal. With -e, the line length is the
+// number of bytes the layout consumes.
+int line_value(ArgParser *parser, int panes) {
+  static FormatProgram *program = NULL;
+  if (ap_found(parser, "format")) {
+    if (program == NULL) {
+      program = format_compile(ap_str_value(parser, "format"));
+      use_format_program(program);
     }
-    if (i < num_bytes) {
-      printf("\033[0;31m %02X\033[0m",
-             buffer[i]); // Print the buffer in hexadecimal format in red color
-    } else {
-      printf("   ");
+    return format_program_length(program);
+  }
+
+  char *value = ap_str_value(parser, "line");
+  if (strcmp(value, "auto") == 0) {
+    int columns = terminal_columns(STDOUT_FILENO);
+    if (columns <= 0) {
+      return 16;
+    }
+    // --diff, --align and --vote print plain hex bytes, --align prints an
+    // offset column for each pane and --vote labels each line with
+    // "majority", "no majority" or the name of the file.
+    if (ap_found(parser, "vote")) {
+      size_t label = strlen("no majority");
+      for (int i = 0; i < ap_count_args(parser); i++) {
+        size_t length = strlen(ap_arg(parser, i));
+        label = length > label ? length : label;
+      }
+      columns -= 2 + (int)label;
+    }
+    if (panes > 1 || ap_found(parser, "vote")) {
+      return fit_line_length(columns, panes,
+                             ap_found(parser, "align") ? panes : 1, RADIX_HEX,
+                             1);
+    }
+    return fit_dump_line_length(columns);
+  }
+
+  char *end;
+  long line_length = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || line_length <= 0 ||
+      line_length > INT_MAX) {
+    fprintf(stderr, "Error: Invalid line length '%s'\n", value);
+    exit(1);
+  }
+  return (int)line_length;
+}
+
+// Returns the word size given with -g.
+int group_value(ArgParser *parser) {
+  int group = ap_int_value(parser, "group");
+  if (group != 1 && group != 2 && group != 4 && group != 8) {
+    fprintf(stderr, "Error: Group size must be 1, 2, 4 or 8\n");
+    exit(1);
+  }
+  return group;
+}
+
+// Returns true if --endian asks for big-endian words.
+bool big_endian(ArgParser *parser) {
+  char *value = ap_str_value(parser, "endian");
+  if (strcmp(value, "big") != 0 && strcmp(value, "little") != 0) {
+    fprintf(stderr, "Error: Invalid byte order '%s'\n", value);
+    exit(1);
+  }
+  return strcmp(value, "big") == 0;
+}
+
+// Returns the radix named with -r.
+Radix radix_value(ArgParser *parser) {
+  static const char *names[] = {"hex", "oct", "dec", "sdec", "bin"};
+  static const Radix radixes[] = {RADIX_HEX, RADIX_OCTAL, RADIX_DECIMAL,
+                                  RADIX_SIGNED, RADIX_BINARY};
+  char *value = ap_str_value(parser, "radix");
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(value, names[i]) == 0) {
+      return radixes[i];
     }
   }
+  fprintf(stderr, "Error: Invalid radix '%s'\n", value);
+  exit(1);
+}
+
+// Sets the unit size and radix for the type named with --as.
+void use_type(ArgParser *parser) {
+  char *value = ap_str_value(parser, "as");
+  int size;
+  Radix radix;
+  if (!try_parse_type(value, &size, &radix)) {
+    fprintf(stderr, "Error: Invalid type '%s'\n", value);
+    exit(1);
+  }
+  use_grouping(size, big_endian(parser));
+  use_radix(radix);
+}
 
-  printf(" | ");
+// Returns the colour scheme named with --colour.
+ColourScheme colour_value(ArgParser *parser) {
+  char *value = ap_str_value(parser, "colour");
+  if (strcmp(value, "class") == 0) {
+    return COLOUR_CLASSES;
+  }
+  if (strcmp(value, "default") != 0) {
+    fprintf(stderr, "Error: Invalid colour scheme '%s'\n", value);
+    exit(1);
+  }
+  return COLOUR_DEFAULT;
+}
 
-  for (int i = 0; i < num_bytes; i++) {
-    if (buffer[i] > 31 && buffer[i] < 127) {
-      printf("\033[0;34m%c\033[0m",
-             buffer[i]); // Print the ASCII representation in blue color
-    } else {
-      printf(".");
+// Returns the character set named with --charset.
+Charset charset_value(ArgParser *parser) {
+  static const char *names[] = {"ascii", "latin1", "ebcdic", "cp437"};
+  static const Charset charsets[] = {CHARSET_ASCII, CHARSET_LATIN1,
+                                     CHARSET_EBCDIC, CHARSET_CP437};
+  char *value = ap_str_value(parser, "charset");
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(value, names[i]) == 0) {
+      return charsets[i];
     }
   }
+  fprintf(stderr, "Error: Invalid character set '%s'\n", value);
+  exit(1);
+}
 
-  printf("\n");
+// Returns true if the line length follows the terminal width.
+bool auto_line(ArgParser *parser) {
+  return !ap_found(parser, "format") &&
+         strcmp(ap_str_value(parser, "line"), "auto") == 0;
 }
 
-void dump_file(FILE *file, int offset, int bytes_to_read, int line_length) {
-  uint8_t *buffer = (uint8_t *)malloc(line_length);
-  if (buffer == NULL) {
+// Returns the non-negative starting offset given with -o.
+uint64_t start_offset(ArgParser *parser) {
+  int64_t offset = size_value(parser, "offset", 0);
+  if (offset < 0) {
+    fprintf(stderr, "Error: Offsets from the end are not supported here\n");
+    exit(1);
+  }
+  return offset;
+}
+
+// Moves the input forward to the specified offset. Inputs that cannot seek,
+// such as pipes, are skipped through by discarding data. Nothing is left to
+// read if the input ends before the offset.
+void seek_input(FILE *file, uint64_t offset) {
+  if (offset == 0 || fseeko(file, offset, SEEK_SET) == 0) {
+    return;
+  }
+  if (errno != ESPIPE) {
+    fprintf(stderr, "Error: Could not seek to offset %llu\n",
+            (unsigned long long)offset);
+    exit(1);
+  }
+  skip_input(fileno(file), offset);
+}
+
+// Opens a file for reading and seeks to the specified offset.
+FILE *open_at(char *filename, uint64_t offset) {
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Could not open file '%s \n", filename);
+    exit(1);
+  }
+  seek_input(file, offset);
+  return file;
+}
+
+// Compares the two positional file arguments. Returns the exit status.
+int run_diff(ArgParser *parser) {
+  if (ap_count_args(parser) != 2) {
+    fprintf(stderr, "Error: --diff and --align require exactly two files\n");
+    exit(1);
+  }
+
+  FILE *files[2];
+  uint64_t offset = start_offset(parser);
+  for (int i = 0; i < 2; i++) {
+    files[i] = open_at(ap_arg(parser, i), offset);
+  }
+
+  int64_t bytes_to_read = size_value(parser, "num", -1);
+  int line_length = line_value(parser, 2);
+  long long differences;
+  if (ap_found(parser, "align")) {
+    differences = diff_aligned(fileno(files[0]), fileno(files[1]), offset,
+                               bytes_to_read, line_length);
+  } else {
+    differences =
+        diff_files(files[0], files[1], offset, bytes_to_read, line_length);
+  }
+
+  fclose(files[0]);
+  fclose(files[1]);
+  ap_free(parser);
+  return differences > 0 ? 1 : 0;
+}
+
+// Compares three or more positional file arguments. Returns the exit status.
+int run_vote(ArgParser *parser) {
+  int count = ap_count_args(parser);
+  if (count < 3) {
+    fprintf(stderr, "Error: --vote requires at least three files\n");
+    exit(1);
+  }
+
+  char **names = ap_args(parser);
+  FILE **files = malloc(sizeof(FILE *) * count);
+  uint64_t offset = start_offset(parser);
+  for (int i = 0; i < count; i++) {
+    files[i] = open_at(names[i], offset);
+  }
+
+  int64_t bytes_to_read = size_value(parser, "num", -1);
+  int line_length = line_value(parser, 1);
+  long long disagreements = vote_files(files, names, count, offset,
+                                       bytes_to_read, line_length);
+
+  for (int i = 0; i < count; i++) {
+    fclose(files[i]);
+  }
+  free(files);
+  free(names);
+  ap_free(parser);
+  return disagreements > 0 ? 1 : 0;
+}
+
+// Returns the number of threads requested by the -j option.
+int thread_count(ArgParser *parser) {
+  int threads = ap_int_value(parser, "threads");
+  if (threads <= 0) {
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  return threads > 0 ? threads : 1;
+}
+
+// Dumps the blocks of the positional file argument that changed since the
+// previous run. Returns the exit status.
+int run_incremental(ArgParser *parser) {
+  if (ap_count_args(parser) != 1) {
+    fprintf(stderr, "Error: --state requires exactly one file\n");
+    exit(1);
+  }
+
+  FILE *file = open_at(ap_arg(parser, 0), 0);
+  char *cache_path = ap_found(parser, "cache") ? ap_str_value(parser, "cache")
+                                               : NULL;
+  dump_incremental(stdout, fileno(file), ap_str_value(parser, "state"),
+                   cache_path, line_value(parser, 1),
+                   thread_count(parser));
+
+  fclose(file);
+  ap_free(parser);
+  return 0;
+}
+
+// Dumps every --range region of the positional file argument. Returns the
+// exit status.
+int run_ranges(ArgParser *parser) {
+  if (ap_count_args(parser) != 1) {
+    fprintf(stderr, "Error: --range requires exactly one file\n");
+    exit(1);
+  }
+
+  int count = ap_count(parser, "range");
+  char **specs = ap_str_values(parser, "range");
+  Range *ranges = malloc(sizeof(Range) * count);
+  for (int i = 0; i < count; i++) {
+    char *colon = strchr(specs[i], ':');
+    if (colon == NULL) {
+      fprintf(stderr, "Error: Expected <start:len>, found '%s'\n", specs[i]);
+      exit(1);
+    }
+    *colon = '\0';
+    int64_t start = parse_size(specs[i]);
+    int64_t length = parse_size(colon + 1);
+    *colon = ':';
+    if (start < 0 || length < 0) {
+      fprintf(stderr, "Error: Invalid range '%s'\n", specs[i]);
+      exit(1);
+    }
+    ranges[i] = (Range){start, length};
+  }
+
+  FILE *file = open_at(ap_arg(parser, 0), 0);
+  dump_ranges(stdout, fileno(file), ranges, count,
+              line_value(parser, 1), thread_count(parser), true);
+
+  fclose(file);
+  free(ranges);
+  free(specs);
+  ap_free(parser);
+  return 0;
+}
+
+// Runs the dump jobs listed in the --batch file. Returns the exit status.
+int run_batch(ArgParser *parser) {
+  char *path = ap_str_value(parser, "batch");
+  FILE *jobs = stdin;
+  if (strcmp(path, "-") != 0) {
+    jobs = fopen(path, "r");
+    if (jobs == NULL) {
+      fprintf(stderr, "Error: Could not open file '%s \n", path);
+      exit(1);
+    }
+  }
+
+  int failures = dump_batch_jobs(stdout, jobs, line_value(parser, 1),
+                                 thread_count(parser));
+
+  if (jobs != stdin) {
+    fclose(jobs);
+  }
+  ap_free(parser);
+  return failures > 0 ? 1 : 0;
+}
+
+// Opens the positional file argument in the interactive pager. Returns the
+// exit status.
+int run_view(ArgParser *parser) {
+  if (ap_count_args(parser) != 1) {
+    fprintf(stderr, "Error: --pager requires exactly one file\n");
+    exit(1);
+  }
+
+  char *filename = ap_arg(parser, 0);
+  FILE *file = open_at(filename, 0);
+  run_pager(fileno(file), filename, start_offset(parser),
+            auto_line(parser) ? 0 : line_value(parser, 1));
+
+  fclose(file);
+  ap_free(parser);
+  return 0;
+}
+
+// Prints the input as a table of the records described by --record.
+// Returns the exit status.
+int run_record(ArgParser *parser) {
+  if (ap_count_args(parser) > 1) {
+    fprintf(stderr, "Error: --record takes at most one file\n");
+    exit(1);
+  }
+
+  RecordLayout *layout = record_load(ap_str_value(parser, "record"));
+  uint64_t offset = start_offset(parser);
+  FILE *file = stdin;
+  if (ap_has_args(parser)) {
+    file = open_at(ap_arg(parser, 0), offset);
+  } else {
+    seek_input(file, offset);
+  }
+  dump_records(stdout, file, offset, size_value(parser, "num", -1), layout);
+
+  record_free(layout);
+  fclose(file);
+  ap_free(parser);
+  return 0;
+}
+
+// Estimates the record length of the input. Returns the exit status.
+int run_detect(ArgParser *parser) {
+  if (ap_count_args(parser) > 1) {
+    fprintf(stderr, "Error: --detect-stride takes at most one file\n");
+    exit(1);
+  }
+  int max_stride = ap_int_value(parser, "max-stride");
+  if (max_stride < 2) {
+    fprintf(stderr, "Error: --max-stride must be at least 2\n");
+    exit(1);
+  }
+
+  uint64_t offset = start_offset(parser);
+  FILE *file = stdin;
+  if (ap_has_args(parser)) {
+    file = open_at(ap_arg(parser, 0), offset);
+  } else {
+    seek_input(file, offset);
+  }
+  detect_stride(stdout, file, size_value(parser, "num", -1), max_stride,
+                thread_count(parser));
+
+  fclose(file);
+  ap_free(parser);
+  return 0;
+}
+
+// Dumps one sample every --sample bytes of the positional file argument.
+// Returns the exit status.
+int run_sample(ArgParser *parser) {
+  if (ap_count_args(parser) != 1) {
+    fprintf(stderr, "Error: --sample requires exactly one file\n");
+    exit(1);
+  }
+
+  int line_length = line_value(parser, 1);
+  int64_t every = size_value(parser, "sample", 0);
+  int64_t size = size_value(parser, "sample-size", line_length);
+  if (every <= 0 || size <= 0) {
+    fprintf(stderr, "Error: Sample sizes must be positive\n");
+    exit(1);
+  }
+
+  FILE *file = open_at(ap_arg(parser, 0), 0);
+  uint64_t end;
+  if (!input_size(fileno(file), &end)) {
+    fprintf(stderr, "Error: --sample requires a file or device of known "
+                    "size\n");
+    exit(1);
+  }
+
+  uint64_t pos = start_offset(parser);
+  int64_t bytes_to_read = size_value(parser, "num", -1);
+  if (bytes_to_read >= 0 && pos + bytes_to_read < end) {
+    end = pos + bytes_to_read;
+  }
+
+  // Hand the samples over in batches to keep the range list small.
+  Range *batch = malloc(sizeof(Range) * SAMPLE_BATCH);
+  while (pos < end) {
+    int count = 0;
+    for (; count < SAMPLE_BATCH && pos < end; count++, pos += every) {
+      uint64_t length =
+          end - pos < (uint64_t)size ? end - pos : (uint64_t)size;
+      batch[count] = (Range){pos, length};
+    }
+    dump_ranges(stdout, fileno(file), batch, count, line_length,
+                thread_count(parser), size > line_length);
+  }
+
+  free(batch);
+  fclose(file);
+  ap_free(parser);
+  return 0;
+}
+
+// Returns the block size requested by the -b option.
+uint32_t block_size(ArgParser *parser) {
+  int block_size = ap_int_value(parser, "block");
+  if (block_size <= 0) {
+    fprintf(stderr, "Error: Block size must be positive\n");
+    exit(1);
+  }
+  return (uint32_t)block_size;
+}
+
+// Returns a freshly-allocated string holding the sidecar index path.
+char *index_path(const char *filename) {
+  char *path = malloc(strlen(filename) + sizeof(".dmpidx"));
+  if (path == NULL) {
     fprintf(stderr, "Error: Insufficient Memory \n");
     exit(1);
   }
+  strcpy(path, filename);
+  strcat(path, ".dmpidx");
+  return path;
+}
+
+// Loads a file's sidecar index, rebuilding and saving it if it is missing,
+// out of date, or was built with a different block size. Block devices are
+// always hashed afresh.
+MerkleTree *load_index(const char *filename, int fd, uint32_t block_size,
+                       int threads) {
+  char *path = index_path(filename);
+  MerkleTree *tree = merkle_load(path);
+  if (tree != NULL &&
+      (tree->block_size != block_size || !merkle_is_current(tree, fd))) {
+    merkle_free(tree);
+    tree = NULL;
+  }
+  if (tree == NULL) {
+    tree = merkle_build(fd, block_size, threads);
+    // Trees of devices are rebuilt every time, so there is no point saving
+    // them.
+    if (merkle_is_current(tree, fd) && !merkle_save(tree, path)) {
+      fprintf(stderr, "Warning: Could not write index '%s'\n", path);
+    }
+  }
+  free(path);
+  return tree;
+}
+
+// Callback for the 'index' command.
+void run_index(char *cmd_name, ArgParser *cmd_parser) {
+  if (!ap_has_args(cmd_parser)) {
+    fprintf(stderr, "Error: %s requires at least one file\n", cmd_name);
+    exit(1);
+  }
 
-  while (true) {
-    int max_bytes;
-    if (bytes_to_read < 0) {
-      max_bytes = line_length;
-    } else if (line_length < bytes_to_read) {
-      max_bytes = line_length;
-    } else {
-      max_bytes = bytes_to_read;
+  for (int i = 0; i < ap_count_args(cmd_parser); i++) {
+    char *filename = ap_arg(cmd_parser, i);
+    FILE *file = open_at(filename, 0);
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode)) {
+      // An index of a device could never be trusted later, see load_index.
+      fprintf(stderr, "Error: Only regular files can be indexed: '%s'\n",
+              filename);
+      exit(1);
+    }
+    MerkleTree *tree = merkle_build(fileno(file), block_size(cmd_parser),
+                                    thread_count(cmd_parser));
+    char *path = index_path(filename);
+    if (!merkle_save(tree, path)) {
+      fprintf(stderr, "Error: Could not write index '%s'\n", path);
+      exit(1);
     }
+    free(path);
+    merkle_free(tree);
+    fclose(file);
+  }
+  exit(0);
+}
+
+// Callback for the 'compare' command.
+void run_compare(char *cmd_name, ArgParser *cmd_parser) {
+  if (ap_count_args(cmd_parser) != 2) {
+    fprintf(stderr, "Error: %s requires exactly two files\n", cmd_name);
+    exit(1);
+  }
+  int line_length = ap_int_value(cmd_parser, "line");
+  if (line_length <= 0) {
+    fprintf(stderr, "Error: Line length must be positive\n");
+    exit(1);
+  }
+
+  FILE *files[2];
+  MerkleTree *trees[2];
+  for (int i = 0; i < 2; i++) {
+    char *filename = ap_arg(cmd_parser, i);
+    files[i] = open_at(filename, 0);
+    trees[i] = load_index(filename, fileno(files[i]), block_size(cmd_parser),
+                          thread_count(cmd_parser));
+  }
+
+  uint64_t *blocks;
+  uint64_t count = merkle_diff(trees[0], trees[1], &blocks);
+  uint64_t size = trees[0]->block_size;
 
-    int num_bytes = fread(buffer, sizeof(uint8_t), max_bytes, file);
-    if (num_bytes > 0) {
-      print_line(buffer, num_bytes, offset, line_length);
-      offset += num_bytes;
-      bytes_to_read -= num_bytes;
-    } else {
-      break;
+  // Coalesce runs of adjacent blocks and diff each run in one go.
+  for (uint64_t i = 0; i < count;) {
+    uint64_t first = blocks[i];
+    uint64_t last = first;
+    while (++i < count && blocks[i] == last + 1) {
+      last = blocks[i];
     }
+    for (int j = 0; j < 2; j++) {
+      if (fseeko(files[j], first * size, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: Could not seek to offset %llu\n",
+                (unsigned long long)(first * size));
+        exit(1);
+      }
+    }
+    diff_files(files[0], files[1], first * size, (last - first + 1) * size,
+               line_length);
+  }
+
+  free(blocks);
+  for (int i = 0; i < 2; i++) {
+    merkle_free(trees[i]);
+    fclose(files[i]);
   }
-  free(buffer);
+  exit(count > 0 ? 1 : 0);
+}
+
+// Callback for the 'serve' command.
+void run_serve(char *cmd_name, ArgParser *cmd_parser) {
+  if (ap_count_args(cmd_parser) != 1) {
+    fprintf(stderr, "Error: %s requires exactly one socket path\n", cmd_name);
+    exit(1);
+  }
+  int line_length = ap_int_value(cmd_parser, "line");
+  if (line_length <= 0) {
+    fprintf(stderr, "Error: Line length must be positive\n");
+    exit(1);
+  }
+  serve(ap_arg(cmd_parser, 0), line_length, ap_int_value(cmd_parser, "files"));
+  exit(0);
 }
 
 int main(int argc, char **argv) {
@@ -85,13 +761,127 @@ int main(int argc, char **argv) {
   ap_version(parser, "0.1.0");
 
   // Add the command line arguments.
-  ap_int_opt(parser, "line l", 16);
-  ap_int_opt(parser, "num n", -1);
-  ap_int_opt(parser, "offset o", 0);
+  ap_str_opt(parser, "line l", "16");
+  ap_str_opt(parser, "format e", NULL);
+  ap_int_opt(parser, "group g", 1);
+  ap_str_opt(parser, "endian", "little");
+  ap_str_opt(parser, "radix r", "hex");
+  ap_str_opt(parser, "as", NULL);
+  ap_str_opt(parser, "colour", "default");
+  ap_str_opt(parser, "highlight", NULL);
+  ap_str_opt(parser, "charset", "ascii");
+  ap_str_opt(parser, "num n", "-1");
+  ap_str_opt(parser, "offset o", "0");
+  ap_str_opt(parser, "tail", "0");
+  ap_str_opt(parser, "range", NULL);
+  ap_str_opt(parser, "sample stride", NULL);
+  ap_str_opt(parser, "sample-size", NULL);
+  ap_str_opt(parser, "batch", NULL);
+  ap_flag(parser, "pager");
+  ap_str_opt(parser, "record", NULL);
+  ap_int_opt(parser, "max-stride", 1024);
+  ap_flag(parser, "follow f");
+  ap_flag(parser, "live");
+  ap_flag(parser, "timestamp t");
+  ap_str_opt(parser, "state", NULL);
+  ap_str_opt(parser, "cache", NULL);
+  ap_int_opt(parser, "threads j", 0);
+  ap_flag(parser, "diff");
+  ap_flag(parser, "align");
+  ap_flag(parser, "vote");
+  ap_flag(parser, "detect-stride");
+
+  // Add the commands.
+  ArgParser *index_cmd = ap_cmd(parser, "index");
+  ap_helptext(index_cmd, index_helptext);
+  ap_int_opt(index_cmd, "block b", 1 << 20);
+  ap_int_opt(index_cmd, "threads j", 0);
+  ap_callback(index_cmd, run_index);
+
+  ArgParser *compare_cmd = ap_cmd(parser, "compare");
+  ap_helptext(compare_cmd, compare_helptext);
+  ap_int_opt(compare_cmd, "block b", 1 << 20);
+  ap_int_opt(compare_cmd, "threads j", 0);
+  ap_int_opt(compare_cmd, "line l", 16);
+  ap_callback(compare_cmd, run_compare);
+
+  ArgParser *serve_cmd = ap_cmd(parser, "serve");
+  ap_helptext(serve_cmd, serve_helptext);
+  ap_int_opt(serve_cmd, "line l", 16);
+  ap_int_opt(serve_cmd, "files m", 16);
+  ap_callback(serve_cmd, run_serve);
 
   // Parse the command line arguments.
   ap_parse(parser, argc, argv);
 
+  if (ap_found(parser, "format")) {
+    if (ap_found(parser, "line") || ap_found(parser, "group") ||
+        ap_found(parser, "radix")) {
+      fprintf(stderr, "Error: --line, --group and --radix cannot be used "
+                      "with --format\n");
+      exit(1);
+    }
+    if (ap_found(parser, "diff") || ap_found(parser, "align") ||
+        ap_found(parser, "vote") || ap_found(parser, "pager")) {
+      fprintf(stderr, "Error: --format only applies to plain dumps\n");
+      exit(1);
+    }
+  }
+  if (ap_found(parser, "as")) {
+    if (ap_found(parser, "group") || ap_found(parser, "radix") ||
+        ap_found(parser, "format")) {
+      fprintf(stderr, "Error: --group, --radix and --format cannot be used "
+                      "with --as\n");
+      exit(1);
+    }
+    use_type(parser);
+  } else {
+    use_grouping(group_value(parser), big_endian(parser));
+    use_radix(radix_value(parser));
+  }
+  use_colours(colour_value(parser));
+  if (ap_found(parser, "charset")) {
+    use_charset(charset_code_points(charset_value(parser)));
+  }
+  if (ap_found(parser, "highlight")) {
+    char **rules = ap_str_values(parser, "highlight");
+    int64_t start = size_value(parser, "offset", 0);
+    use_highlight_rules(rules, ap_count(parser, "highlight"),
+                        ap_has_args(parser) ? ap_arg(parser, 0) : NULL,
+                        start > 0 ? start : 0,
+                        start >= 0 ? size_value(parser, "num", -1) : -1);
+    free(rules);
+  }
+
+  if (ap_found(parser, "diff") || ap_found(parser, "align")) {
+    exit(run_diff(parser));
+  }
+  if (ap_found(parser, "vote")) {
+    exit(run_vote(parser));
+  }
+
+  if (ap_found(parser, "state")) {
+    exit(run_incremental(parser));
+  }
+  if (ap_found(parser, "range")) {
+    exit(run_ranges(parser));
+  }
+  if (ap_found(parser, "sample")) {
+    exit(run_sample(parser));
+  }
+  if (ap_found(parser, "batch")) {
+    exit(run_batch(parser));
+  }
+  if (ap_found(parser, "pager")) {
+    exit(run_view(parser));
+  }
+  if (ap_found(parser, "record")) {
+    exit(run_record(parser));
+  }
+  if (ap_found(parser, "detect-stride")) {
+    exit(run_detect(parser));
+  }
+
   // Get the file name from the command line arguments.
   FILE *file = stdin;
   if (ap_has_args(parser)) {
@@ -103,19 +893,60 @@ int main(int argc, char **argv) {
     }
   }
 
-  // Get to the specified Offset.
-  int offset = ap_int_value(parser, "offset");
-  if (offset != 0) {
-    if (fseek(file, offset, SEEK_SET) != 0) {
-      fprintf(stderr, "Error: Could not seek to offset %d\n", offset);
+  // Get to the specified Offset. Negative offsets count back from the end.
+  uint64_t offset = 0;
+  void *tail_memory = NULL;
+  int64_t start = size_value(parser, "offset", 0);
+  uint64_t size;
+  if (ap_found(parser, "live") && (ap_found(parser, "tail") || start < 0) &&
+      !input_size(fileno(file), &size)) {
+    // The tail of a pipe is only known once it has ended.
+    fprintf(stderr, "Error: --live cannot start from the end of a pipe\n");
+    exit(1);
+  }
+  if (ap_found(parser, "tail")) {
+    int64_t tail = size_value(parser, "tail", 0);
+    if (tail < 0) {
+      fprintf(stderr, "Error: --tail requires a non-negative byte count\n");
+      exit(1);
+    }
+    file = seek_tail(file, tail, &offset, &tail_memory);
+  } else if (start < 0) {
+    file = seek_tail(file, -start, &offset, &tail_memory);
+  } else {
+    offset = start;
+    seek_input(file, offset);
+  }
+
+  int64_t bytes_to_read = size_value(parser, "num", -1);
+  int line_length = line_value(parser, 1);
+  if (ap_found(parser, "live")) {
+    dump_live(stdout, fileno(file), offset, bytes_to_read, line_length,
+              ap_found(parser, "timestamp"));
+    fclose(file);
+    free(tail_memory);
+    ap_free(parser);
+    return 0;
+  }
+
+  Follower *follower = NULL;
+  if (ap_found(parser, "follow")) {
+    if (file == stdin) {
+      fprintf(stderr, "Error: --follow requires a file\n");
       exit(1);
     }
+    follower = follower_new(ap_arg(parser, 0), file);
   }
 
-  int bytes_to_read = ap_int_value(parser, "num");
-  int line_length = ap_int_value(parser, "line");
-  dump_file(file, offset, bytes_to_read, line_length);
+  if (auto_line(parser) && terminal_columns(STDOUT_FILENO) > 0) {
+    watch_terminal_width();
+  }
+  dump_file(stdout, file, offset, bytes_to_read, line_length, follower);
 
+  if (follower != NULL) {
+    follower_free(follower);
+  }
   fclose(file);
+  free(tail_memory);
   ap_free(parser);
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "dump.h"
+#include "format.h"
+#include "io.h"
+#include "terminal.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void print_lines(FILE *out, uint8_t *buffer, size_t num_bytes, uint64_t offset,
+                 int line_length) {
+  char text[2048];
+  char *line = text;
+  if (line_text_size(line_length) > sizeof(text)) {
+    line = malloc(line_text_size(line_length));
+    if (line == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+  }
+  LineFormatter format = line_formatter(line_length);
+  for (size_t i = 0; i < num_bytes; i += line_length) {
+    int length = num_bytes - i < (size_t)line_length ? (int)(num_bytes - i)
+                                                     : line_length;
+    fwrite(line, 1, format(line, buffer + i, length, offset + i, line_length),
+           out);
+  }
+  if (line != text) {
+    free(line);
+  }
+}
+
+void dump_file(FILE *out, FILE *file, uint64_t offset, int64_t bytes_to_read,
+               int line_length, Follower *follower) {
+  uint8_t *buffer = (uint8_t *)malloc(line_length);
+  char *text = malloc(line_text_size(line_length));
+  if (buffer == NULL || text == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  LineFormatter format = line_formatter(line_length);
+
+  while (true) {
+    // With --line auto, a resized terminal gets a new line length.
+    if (terminal_resized) {
+      terminal_resized = 0;
+      int columns = terminal_columns(fileno(out));
+      if (columns > 0) {
+        line_length = fit_dump_line_length(columns);
+        buffer = (uint8_t *)realloc(buffer, line_length);
+        text = realloc(text, line_text_size(line_length));
+        if (buffer == NULL || text == NULL) {
+          fprintf(stderr, "Error: Insufficient Memory \n");
+          exit(1);
+        }
+        format = line_formatter(line_length);
+      }
+    }
+
+    int max_bytes;
+    if (bytes_to_read < 0) {
+      max_bytes = line_length;
+    } else if (line_length < bytes_to_read) {
+      max_bytes = line_length;
+    } else {
+      max_bytes = bytes_to_read;
+    }
+
+    int num_bytes = fread(buffer, sizeof(uint8_t), max_bytes, file);
+    if (num_bytes > 0) {
+      fwrite(text, 1, format(text, buffer, num_bytes, offset, line_length),
+             out);
+      offset += num_bytes;
+      bytes_to_read -= num_bytes;
+    } else if (follower != NULL && max_bytes > 0) {
+      fflush(out);
+      if (!follower_wait(follower)) {
+        break;
+      }
+    } else {
+      break;
+    }
+  }
+  free(buffer);
+  free(text);
+}
+
+// Reverses the bytes in [lo, hi).
+static void reverse(uint8_t *lo, uint8_t *hi) {
+  while (lo + 1 < hi) {
+    uint8_t tmp = *lo;
+    *lo++ = *--hi;
+    *hi = tmp;
+  }
+}
+
+// Rotates buffer[0, length) left by `shift` bytes in place.
+static void rotate(uint8_t *buffer, size_t length, size_t shift) {
+  reverse(buffer, buffer + shift);
+  reverse(buffer + shift, buffer + length);
+  reverse(buffer, buffer + length);
+}
+
+FILE *seek_tail(FILE *file, uint64_t length, uint64_t *offset, void **memory) {
+  uint64_t size;
+  *memory = NULL;
+  if (input_size(fileno(file), &size)) {
+    *offset = size > length ? size - length : 0;
+    if (fseeko(file, *offset, SEEK_SET) != 0) {
+      fprintf(stderr, "Error: Could not seek to offset %llu\n",
+              (unsigned long long)*offset);
+      exit(1);
+    }
+    return file;
+  }
+
+  uint8_t *ring = (uint8_t *)malloc(length > 0 ? length : 1);
+  if (ring == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  // Fill the ring, wrapping around, until the input ends.
+  uint64_t total = 0;
+  size_t pos = 0;
+  while (length > 0) {
+    size_t num_bytes = fread(ring + pos, 1, length - pos, file);
+    if (num_bytes == 0) {
+      break;
+    }
+    total += num_bytes;
+    pos = (pos + num_bytes) % length;
+  }
+
+  // Put the oldest byte first.
+  size_t kept = total < length ? total : length;
+  if (total > length) {
+    rotate(ring, length, pos);
+  }
+  *offset = total - kept;
+
+  FILE *tail = fmemopen(ring, kept > 0 ? kept : 1, "rb");
+  if (tail == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  if (kept == 0) {
+    fseek(tail, 0, SEEK_END);
+  }
+
+  fclose(file);
+  *memory = ring;
+  return tail;
+}
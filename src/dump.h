@@ -0,0 +1,29 @@
+#ifndef dump_h
+#define dump_h
+
+#include "follow.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Prints num_bytes bytes starting at `offset` as lines of line_length bytes:
+// each the offset, the bytes in hexadecimal, and their ASCII representation.
+// The last line may be short.
+void print_lines(FILE *out, uint8_t *buffer, size_t num_bytes, uint64_t offset,
+                 int line_length);
+
+// Dumps the input from its current position. A negative bytes_to_read dumps
+// until the end of the input. If follower is not NULL, reaching the end of
+// the input waits for it to grow and carries on dumping the new bytes.
+void dump_file(FILE *out, FILE *file, uint64_t offset, int64_t bytes_to_read,
+               int line_length, Follower *follower);
+
+// Positions the input at its last `length` bytes and stores their offset in
+// *offset. Files and block devices are seeked relative to their end.
+// Anything else is read to the end through a ring buffer that keeps only the
+// last `length` bytes, which are returned as an in-memory stream; in that
+// case the input is closed, the returned stream replaces it, and *memory is
+// set to the buffer to free once the stream is closed (otherwise it is set
+// to NULL).
+FILE *seek_tail(FILE *file, uint64_t length, uint64_t *offset, void **memory);
+
+#endif
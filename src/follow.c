@@ -0,0 +1,97 @@
+#include "follow.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Interval between size checks on systems without inotify.
+#define FOLLOW_POLL_NS 100000000
+
+struct Follower {
+  FILE *file;
+  int inotify_fd;
+};
+
+Follower *follower_new(const char *path, FILE *file) {
+  Follower *follower = malloc(sizeof(Follower));
+  if (follower == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  follower->file = file;
+  follower->inotify_fd = -1;
+
+#ifdef __linux__
+  follower->inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (follower->inotify_fd < 0 ||
+      inotify_add_watch(follower->inotify_fd, path,
+                        IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF) < 0) {
+    fprintf(stderr, "Error: Could not watch file '%s'\n", path);
+    exit(1);
+  }
+#else
+  (void)path;
+#endif
+
+  return follower;
+}
+
+// Compares the file's size with the stream position. Returns 1 if the file
+// has grown, 0 if not, and -1 if it has been truncated or removed.
+static int check_growth(Follower *follower) {
+  struct stat st;
+  if (fstat(fileno(follower->file), &st) != 0 || st.st_nlink == 0) {
+    return -1;
+  }
+  off_t pos = ftello(follower->file);
+  if (st.st_size < pos) {
+    fprintf(stderr, "Warning: File truncated\n");
+    return -1;
+  }
+  return st.st_size > pos ? 1 : 0;
+}
+
+bool follower_wait(Follower *follower) {
+  clearerr(follower->file);
+
+  while (true) {
+    // Check before blocking, as the file may have grown since the last read.
+    int growth = check_growth(follower);
+    if (growth != 0) {
+      return growth > 0;
+    }
+
+#ifdef __linux__
+    char events[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n = read(follower->inotify_fd, events, sizeof(events));
+    if (n < 0 && errno != EINTR) {
+      return false;
+    }
+    for (char *p = events; n > 0 && p < events + n;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+        return false;
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+#else
+    struct timespec delay = {0, FOLLOW_POLL_NS};
+    nanosleep(&delay, NULL);
+#endif
+  }
+}
+
+void follower_free(Follower *follower) {
+  if (follower->inotify_fd >= 0) {
+    close(follower->inotify_fd);
+  }
+  free(follower);
+}
@@ -0,0 +1,22 @@
+#ifndef follow_h
+#define follow_h
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// A Follower waits for a file to grow, like `tail -f`.
+typedef struct Follower Follower;
+
+// Starts watching the file at path, which is open for reading as `file`.
+// Exits with an error message if the file cannot be watched.
+Follower *follower_new(const char *path, FILE *file);
+
+// Blocks until the file has grown past the current read position of the
+// stream. Uses inotify where available, so no CPU is spent while the file is
+// idle. Returns false if the file was truncated or removed.
+bool follower_wait(Follower *follower);
+
+// Stops watching and frees the follower. The file itself is not closed.
+void follower_free(Follower *follower);
+
+#endif
@@ -0,0 +1,1182 @@
+#include "format.h"
+#include "hash.h"
+#include <float.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Colour codes around each part of a line: the offset is yellow, the hex
+// bytes red and the printable ASCII characters blue.
+#define OFFSET_COLOUR "\033[0;33m"
+#define HEX_COLOUR "\033[0;31m"
+#define ASCII_COLOUR "\033[0;34m"
+#define RESET_COLOUR "\033[0m"
+
+// Lengths of a byte's hex cell, e.g. "\033[0;31m 4F\033[0m", and of the
+// longest ASCII cell, a character of up to three bytes of UTF-8 such as
+// "\033[0;34m\u2592\033[0m".
+#define HEX_CELL_SIZE 14
+#define ASCII_CELL_SIZE 14
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// The formatted text of every byte value, built once.
+static char hex_cells[256][HEX_CELL_SIZE];
+static char ascii_cells[256][ASCII_CELL_SIZE];
+static uint8_t ascii_lengths[256];
+// The character of each byte value without colour, in UTF-8.
+static char glyphs[256][GLYPH_MAX];
+static uint8_t glyph_lengths[256];
+static char hex_pairs[256][2];
+static char octal_triples[512][3];
+static char decimal_triples[1000][3];
+static char binary_octets[256][8];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+static ColourScheme colour_scheme = COLOUR_DEFAULT;
+
+// Code point shown in the text column for each byte value, 0 for '.', or
+// NULL for printable ASCII.
+static const uint16_t *charset = NULL;
+
+// Highlighted cells are the normal cells in reverse video. Highlighted byte
+// values use them in place of the normal cells, and highlighted offset
+// ranges are looked up once per line.
+static char marked_hex_cells[256][HEX_CELL_SIZE];
+static char marked_ascii_cells[256][ASCII_CELL_SIZE];
+static uint8_t marked_ascii_lengths[256];
+static bool highlight_values[256];
+static HighlightRange *highlight_ranges = NULL;
+static int highlight_count = 0;
+
+typedef enum {
+  CLASS_NUL,
+  CLASS_PRINTABLE,
+  CLASS_SPACE, // Space, tab, newline, vertical tab, form feed and return.
+  CLASS_CONTROL,
+  CLASS_HIGH, // Bytes with the high bit set.
+} ByteClass;
+
+// Colours of the byte classes with --colour class, all as long as
+// HEX_COLOUR so that every cell keeps its fixed size.
+static const char class_colours[][8] = {
+    [CLASS_NUL] = "\033[1;30m",     [CLASS_PRINTABLE] = "\033[0;32m",
+    [CLASS_SPACE] = "\033[0;36m",   [CLASS_CONTROL] = "\033[0;35m",
+    [CLASS_HIGH] = "\033[0;31m",
+};
+
+static ByteClass byte_class(int b) {
+  if (b == 0) {
+    return CLASS_NUL;
+  }
+  if (b == ' ' || (b >= '\t' && b <= '\r')) {
+    return CLASS_SPACE;
+  }
+  if (b > 31 && b < 127) {
+    return CLASS_PRINTABLE;
+  }
+  return b < 128 ? CLASS_CONTROL : CLASS_HIGH;
+}
+
+// Builds the hex and ASCII cells of every byte value in the current colour
+// scheme. The colours are baked into the cells, so a richer scheme costs
+// nothing per byte.
+static void build_cells(void) {
+  static const char upper_digits[] = "0123456789ABCDEF";
+  for (int b = 0; b < 256; b++) {
+    bool by_class = colour_scheme == COLOUR_CLASSES;
+    const char *colour = by_class ? class_colours[byte_class(b)] : HEX_COLOUR;
+    char *cell = hex_cells[b];
+    memcpy(cell, colour, 7);
+    cell[7] = ' ';
+    cell[8] = upper_digits[b >> 4];
+    cell[9] = upper_digits[b & 15];
+    memcpy(hex_pairs[b], cell + 8, 2);
+    memcpy(cell + 10, RESET_COLOUR, 4);
+
+    // Encode the byte's character in UTF-8.
+    int code = charset != NULL ? charset[b] : (b > 31 && b < 127 ? b : 0);
+    char glyph[3] = {'.'};
+    int glyph_length = 1;
+    if (code >= 0x800) {
+      glyph[0] = (char)(0xe0 | code >> 12);
+      glyph[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+      glyph[2] = (char)(0x80 | (code & 0x3f));
+      glyph_length = 3;
+    } else if (code >= 0x80) {
+      glyph[0] = (char)(0xc0 | code >> 6);
+      glyph[1] = (char)(0x80 | (code & 0x3f));
+      glyph_length = 2;
+    } else if (code > 0) {
+      glyph[0] = (char)code;
+    }
+    memcpy(glyphs[b], glyph, glyph_length);
+    glyph_lengths[b] = glyph_length;
+
+    char *marked = marked_ascii_cells[b];
+    memcpy(marked, by_class ? colour : ASCII_COLOUR, 7);
+    memcpy(marked + 7, glyph, glyph_length);
+    memcpy(marked + 7 + glyph_length, RESET_COLOUR, 4);
+    marked_ascii_lengths[b] = 11 + glyph_length;
+    if (by_class || code > 0) {
+      memcpy(ascii_cells[b], marked, ASCII_CELL_SIZE);
+      ascii_lengths[b] = marked_ascii_lengths[b];
+    } else {
+      ascii_cells[b][0] = '.';
+      ascii_lengths[b] = 1;
+    }
+    // Turn "\033[0;31m" into the reverse video "\033[7;31m".
+    marked[2] = '7';
+    memcpy(marked_hex_cells[b], cell, HEX_CELL_SIZE);
+    marked_hex_cells[b][2] = '7';
+
+    if (highlight_values[b]) {
+      memcpy(cell, marked_hex_cells[b], HEX_CELL_SIZE);
+      memcpy(ascii_cells[b], marked, ASCII_CELL_SIZE);
+      ascii_lengths[b] = marked_ascii_lengths[b];
+    }
+  }
+}
+
+static void build_tables(void) {
+  build_cells();
+  for (int b = 0; b < 256; b++) {
+    for (int bit = 0; bit < 8; bit++) {
+      binary_octets[b][bit] = '0' + ((b >> (7 - bit)) & 1);
+    }
+  }
+
+  for (int n = 0; n < 512; n++) {
+    octal_triples[n][0] = '0' + (n >> 6);
+    octal_triples[n][1] = '0' + ((n >> 3) & 7);
+    octal_triples[n][2] = '0' + (n & 7);
+  }
+  for (int n = 0; n < 1000; n++) {
+    decimal_triples[n][0] = '0' + n / 100;
+    decimal_triples[n][1] = '0' + n / 10 % 10;
+    decimal_triples[n][2] = '0' + n % 10;
+  }
+}
+
+char *put_offset(char *p, uint64_t offset) {
+  memcpy(p, OFFSET_COLOUR, 7);
+  p += 7;
+  int digits = 8;
+  while (digits < 16 && (offset >> (4 * digits)) != 0) {
+    digits++;
+  }
+  for (int i = digits - 1; i >= 0; i--) {
+    *p++ = hex_digits[(offset >> (4 * i)) & 15];
+  }
+  memcpy(p, RESET_COLOUR " ", 5);
+  return p + 5;
+}
+
+static size_t format_generic(char *out, const uint8_t *bytes, int num_bytes,
+                             uint64_t offset, int line_length) {
+  char *p = put_offset(out, offset);
+  for (int i = 0; i < line_length; i++) {
+    if (i > 0 && i % 4 == 0) {
+      *p++ = ' ';
+    }
+    if (i < num_bytes) {
+      memcpy(p, hex_cells[bytes[i]], HEX_CELL_SIZE);
+      p += HEX_CELL_SIZE;
+    } else {
+      memcpy(p, "   ", 3);
+      p += 3;
+    }
+  }
+
+  memcpy(p, " | ", 3);
+  p += 3;
+  for (int i = 0; i < num_bytes; i++) {
+    memcpy(p, ascii_cells[bytes[i]], ASCII_CELL_SIZE);
+    p += ascii_lengths[bytes[i]];
+  }
+  *p++ = '\n';
+  return p - out;
+}
+
+// Building blocks of the unrolled formatters. Every ASCII cell copies the
+// full cell size and advances by the cell's real length, so there is no
+// branch on whether a byte is printable.
+#define HEX_CELL(i)                                                            \
+  memcpy(p, hex_cells[bytes[i]], HEX_CELL_SIZE);                               \
+  p += HEX_CELL_SIZE;
+#define ASCII_CELL(i)                                                          \
+  memcpy(p, ascii_cells[bytes[i]], ASCII_CELL_SIZE);                           \
+  p += ascii_lengths[bytes[i]];
+#define GAP *p++ = ' ';
+
+#define HEX_4(i) HEX_CELL(i) HEX_CELL(i + 1) HEX_CELL(i + 2) HEX_CELL(i + 3)
+#define HEX_8(i) HEX_4(i) GAP HEX_4(i + 4)
+#define HEX_16(i) HEX_8(i) GAP HEX_8(i + 8)
+#define HEX_32(i) HEX_16(i) GAP HEX_16(i + 16)
+#define HEX_64(i) HEX_32(i) GAP HEX_32(i + 32)
+
+#define ASCII_4(i)                                                             \
+  ASCII_CELL(i) ASCII_CELL(i + 1) ASCII_CELL(i + 2) ASCII_CELL(i + 3)
+#define ASCII_8(i) ASCII_4(i) ASCII_4(i + 4)
+#define ASCII_16(i) ASCII_8(i) ASCII_8(i + 8)
+#define ASCII_32(i) ASCII_16(i) ASCII_16(i + 16)
+#define ASCII_64(i) ASCII_32(i) ASCII_32(i + 32)
+
+// Defines format_line_<width>, which formats complete lines of exactly
+// `width` bytes in straight-line code and hands anything else to the
+// generic formatter.
+#define DEFINE_FORMATTER(width)                                                \
+  static size_t format_line_##width(char *out, const uint8_t *bytes,           \
+                                    int num_bytes, uint64_t offset,            \
+                                    int line_length) {                         \
+    if (num_bytes != width) {                                                  \
+      return format_generic(out, bytes, num_bytes, offset, line_length);       \
+    }                                                                          \
+    char *p = put_offset(out, offset);                                         \
+    HEX_##width(0);                                                            \
+    memcpy(p, " | ", 3);                                                       \
+    p += 3;                                                                    \
+    ASCII_##width(0);                                                          \
+    *p++ = '\n';                                                               \
+    return p - out;                                                            \
+  }
+
+DEFINE_FORMATTER(8)
+DEFINE_FORMATTER(16)
+DEFINE_FORMATTER(32)
+DEFINE_FORMATTER(64)
+
+// Bytes per word in the hex column, and whether words are read big-endian.
+static int group_size = 1;
+static bool group_big_endian = false;
+
+// Loads a word of `size` bytes in the given byte order. Whole words are
+// byte-swapped with a single instruction when their order differs from the
+// host's.
+static inline uint64_t load_word(const uint8_t *bytes, int size,
+                                 bool big_endian) {
+  bool swap = big_endian != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+  switch (size) {
+  case 1:
+    return bytes[0];
+  case 2: {
+    uint16_t word;
+    memcpy(&word, bytes, 2);
+    return swap ? __builtin_bswap16(word) : word;
+  }
+  case 4: {
+    uint32_t word;
+    memcpy(&word, bytes, 4);
+    return swap ? __builtin_bswap32(word) : word;
+  }
+  case 8: {
+    uint64_t word;
+    memcpy(&word, bytes, 8);
+    return swap ? __builtin_bswap64(word) : word;
+  }
+  default: {
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) {
+      value = value << 8 | bytes[big_endian ? i : size - 1 - i];
+    }
+    return value;
+  }
+  }
+}
+
+// Writes a word of `size` bytes as one hex cell, most significant byte
+// first.
+static inline char *put_word(char *p, const uint8_t *bytes, int size) {
+  uint64_t value = load_word(bytes, size, group_big_endian);
+  memcpy(p, HEX_COLOUR " ", 8);
+  p += 8;
+  for (int i = size - 1; i >= 0; i--) {
+    memcpy(p, hex_pairs[(value >> (8 * i)) & 255], 2);
+    p += 2;
+  }
+  memcpy(p, RESET_COLOUR, 4);
+  return p + 4;
+}
+
+// Writes a word that is cut short by the end of the line or of the input,
+// leaving blanks in place of the missing bytes.
+static char *put_partial_word(char *p, const uint8_t *bytes, int present,
+                              int size) {
+  memcpy(p, HEX_COLOUR " ", 8);
+  p += 8;
+  for (int k = 0; k < size; k++) {
+    int i = group_big_endian ? k : size - 1 - k;
+    memcpy(p, i < present ? hex_pairs[bytes[i]] : "  ", 2);
+    p += 2;
+  }
+  memcpy(p, RESET_COLOUR, 4);
+  return p + 4;
+}
+
+static size_t format_grouped(char *out, const uint8_t *bytes, int num_bytes,
+                             uint64_t offset, int line_length) {
+  char *p = put_offset(out, offset);
+  for (int i = 0; i < line_length; i += group_size) {
+    if (i > 0 && i % 4 == 0 && group_size < 4) {
+      *p++ = ' ';
+    }
+    int size = line_length - i < group_size ? line_length - i : group_size;
+    if (size == group_size && i + size <= num_bytes) {
+      p = put_word(p, bytes + i, size);
+    } else {
+      int present = num_bytes - i;
+      p = put_partial_word(p, bytes + i, present > 0 ? present : 0, size);
+    }
+  }
+
+  memcpy(p, " | ", 3);
+  p += 3;
+  for (int i = 0; i < num_bytes; i++) {
+    memcpy(p, ascii_cells[bytes[i]], ASCII_CELL_SIZE);
+    p += ascii_lengths[bytes[i]];
+  }
+  *p++ = '\n';
+  return p - out;
+}
+
+void use_grouping(int group, bool big_endian) {
+  group_size = group;
+  group_big_endian = big_endian;
+}
+
+static Radix unit_radix = RADIX_HEX;
+
+int unit_width(Radix radix, int size) {
+  static const int decimal[9] = {0, 3, 5, 8, 10, 13, 15, 17, 20};
+  static const int signed_decimal[9] = {0, 4, 6, 8, 11, 13, 15, 18, 20};
+  switch (radix) {
+  case RADIX_OCTAL:
+    return (8 * size + 2) / 3;
+  case RADIX_DECIMAL:
+    return decimal[size];
+  case RADIX_SIGNED:
+    return signed_decimal[size];
+  case RADIX_BINARY:
+    return 8 * size;
+  case RADIX_FLOAT:
+    // Longest shortest round-trip forms: "-1.17549435e-38" and
+    // "-2.2250738585072014e-308".
+    return size == 8 ? 24 : 15;
+  default:
+    return 2 * size;
+  }
+}
+
+bool try_parse_type(const char *name, int *size, Radix *radix) {
+  static const struct {
+    const char *name;
+    int size;
+    Radix radix;
+  } types[] = {
+      {"u8", 1, RADIX_DECIMAL},  {"i8", 1, RADIX_SIGNED},
+      {"u16", 2, RADIX_DECIMAL}, {"i16", 2, RADIX_SIGNED},
+      {"u32", 4, RADIX_DECIMAL}, {"i32", 4, RADIX_SIGNED},
+      {"u64", 8, RADIX_DECIMAL}, {"i64", 8, RADIX_SIGNED},
+      {"f32", 4, RADIX_FLOAT},   {"f64", 8, RADIX_FLOAT},
+  };
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    if (strcmp(name, types[i].name) == 0) {
+      *size = types[i].size;
+      *radix = types[i].radix;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Writes the low `width` octal digits of value, nine bits per lookup.
+static inline char *put_octal(char *p, uint64_t value, int width) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  char *start = end;
+  while (end - start < width) {
+    start -= 3;
+    memcpy(start, octal_triples[value & 511], 3);
+    value >>= 9;
+  }
+  memcpy(p, end - width, width);
+  return p + width;
+}
+
+// Writes value in decimal, right-aligned to `width` characters, three
+// digits per lookup.
+static inline char *put_decimal(char *p, uint64_t value, bool negative,
+                                int width) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  char *start = end;
+  while (value >= 1000) {
+    uint64_t rest = value / 1000;
+    start -= 3;
+    memcpy(start, decimal_triples[value - rest * 1000], 3);
+    value = rest;
+  }
+  int leading = value >= 100 ? 3 : value >= 10 ? 2 : 1;
+  start -= leading;
+  memcpy(start, decimal_triples[value] + 3 - leading, leading);
+  if (negative) {
+    *--start = '-';
+  }
+
+  int length = end - start;
+  memset(p, ' ', width - length);
+  memcpy(p + width - length, start, length);
+  return p + width;
+}
+
+// Writes value as 8 * size bits, most significant first, a byte per lookup.
+static inline char *put_binary(char *p, uint64_t value, int size) {
+  for (int i = size - 1; i >= 0; i--) {
+    memcpy(p, binary_octets[(value >> (8 * i)) & 255], 8);
+    p += 8;
+  }
+  return p;
+}
+
+// Writes the shortest decimal of a float or double between 1e-4 and 1e6 in
+// plain notation, which is what "%g" picks in that range, and returns its
+// length. Tries 0, 1, 2... decimals and stops at the first that reads back
+// as the same value, so that typical values such as 23.47 cost a few
+// multiplications and one conversion. Returns 0 if the value is out of range
+// or needs more digits than can be held exactly.
+static int put_short_float(char *text, double number, bool is_float) {
+  static const double powers[] = {1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,
+                                  1e7, 1e8, 1e9,  1e10, 1e11, 1e12, 1e13,
+                                  1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20};
+  double magnitude = number < 0 ? -number : number;
+  if (!(magnitude >= 1e-4 && magnitude < 1e6)) {
+    return 0;
+  }
+  // Largest significand with exactly representable candidates.
+  double limit = is_float ? 1e9 : 9007199254740992.0;
+
+  for (int decimals = 0; decimals <= 20; decimals++) {
+    double scaled = magnitude * powers[decimals];
+    if (scaled >= limit) {
+      return 0;
+    }
+    uint64_t digits = (uint64_t)(scaled + 0.5);
+    double candidate = (double)digits / powers[decimals];
+    if (is_float ? (float)candidate != (float)magnitude
+                 : candidate != magnitude) {
+      continue;
+    }
+
+    char reversed[24];
+    int count = 0;
+    for (; digits > 0 || count <= decimals; digits /= 10) {
+      reversed[count++] = '0' + digits % 10;
+    }
+    char *p = text;
+    if (number < 0) {
+      *p++ = '-';
+    }
+    while (count > 0) {
+      if (count == decimals) {
+        *p++ = '.';
+      }
+      *p++ = reversed[--count];
+    }
+    // A double rounding through double can pick a neighbour of a float.
+    if (is_float && strtof(text, NULL) != (float)number) {
+      return 0;
+    }
+    return p - text;
+  }
+  return 0;
+}
+
+// Writes a 4- or 8-byte float in the fewest significant digits that read
+// back as the same value, right-aligned to `width` characters. Any other
+// size cannot hold a float and is left blank.
+static char *put_float(char *p, uint64_t value, int size, int width) {
+  char text[32];
+  int length = 0;
+  if (size == 4) {
+    uint32_t bits = (uint32_t)value;
+    float number;
+    memcpy(&number, &bits, 4);
+    length = put_short_float(text, number, true);
+    // Six digits are exact for every normal float that needs no more.
+    int first = number > -FLT_MIN && number < FLT_MIN ? 1 : FLT_DIG;
+    for (int digits = first; length == 0 && digits <= 9; digits++) {
+      int written = snprintf(text, sizeof(text), "%.*g", digits, number);
+      if (strtof(text, NULL) == number || number != number || digits == 9) {
+        length = written;
+      }
+    }
+  } else if (size == 8) {
+    double number;
+    memcpy(&number, &value, 8);
+    length = put_short_float(text, number, false);
+    int first = number > -DBL_MIN && number < DBL_MIN ? 1 : DBL_DIG;
+    for (int digits = first; length == 0 && digits <= 17; digits++) {
+      int written = snprintf(text, sizeof(text), "%.*g", digits, number);
+      if (strtod(text, NULL) == number || number != number || digits == 17) {
+        length = written;
+      }
+    }
+  }
+  memset(p, ' ', width - length);
+  memcpy(p + width - length, text, length);
+  return p + width;
+}
+
+// Writes the digits of a unit's value in the given radix, padded to the
+// unit's width.
+static inline char *put_digits(char *p, uint64_t value, int size,
+                               Radix radix) {
+  int width = unit_width(radix, size);
+  switch (radix) {
+  case RADIX_OCTAL:
+    return put_octal(p, value, width);
+  case RADIX_DECIMAL:
+    return put_decimal(p, value, false, width);
+  case RADIX_SIGNED: {
+    uint64_t sign = (uint64_t)1 << (8 * size - 1);
+    bool negative = (value & sign) != 0;
+    // Two's complement negation within the unit's width.
+    return put_decimal(p,
+                       negative ? ((~value + 1) & (sign | (sign - 1))) : value,
+                       negative, width);
+  }
+  case RADIX_BINARY:
+    return put_binary(p, value, size);
+  case RADIX_FLOAT:
+    return put_float(p, value, size, width);
+  default:
+    for (int i = size - 1; i >= 0; i--) {
+      memcpy(p, hex_pairs[(value >> (8 * i)) & 255], 2);
+      p += 2;
+    }
+    return p;
+  }
+}
+
+char *put_value(char *p, const uint8_t *bytes, int size, Radix radix,
+                bool big_endian) {
+  pthread_once(&tables_once, build_tables);
+  return put_digits(p, load_word(bytes, size, big_endian), size, radix);
+}
+
+// Writes a unit of `size` bytes as one cell in the current radix.
+static inline char *put_unit(char *p, const uint8_t *bytes, int size) {
+  memcpy(p, HEX_COLOUR " ", 8);
+  p = put_digits(p + 8, load_word(bytes, size, group_big_endian), size,
+                 unit_radix);
+  memcpy(p, RESET_COLOUR, 4);
+  return p + 4;
+}
+
+static size_t format_radix(char *out, const uint8_t *bytes, int num_bytes,
+                           uint64_t offset, int line_length) {
+  char *p = put_offset(out, offset);
+  for (int i = 0; i < line_length; i += group_size) {
+    if (i > 0 && i % 4 == 0 && group_size < 4) {
+      *p++ = ' ';
+    }
+    int size = line_length - i < group_size ? line_length - i : group_size;
+    if (i + size <= num_bytes) {
+      p = put_unit(p, bytes + i, size);
+    } else if (i < num_bytes) {
+      // Like od, a unit cut short by the end of the input is zero-filled.
+      uint8_t unit[8] = {0};
+      memcpy(unit, bytes + i, num_bytes - i);
+      p = put_unit(p, unit, size);
+    } else {
+      int width = 1 + unit_width(unit_radix, size);
+      memset(p, ' ', width);
+      p += width;
+    }
+  }
+
+  memcpy(p, " | ", 3);
+  p += 3;
+  for (int i = 0; i < num_bytes; i++) {
+    memcpy(p, ascii_cells[bytes[i]], ASCII_CELL_SIZE);
+    p += ascii_lengths[bytes[i]];
+  }
+  *p++ = '\n';
+  return p - out;
+}
+
+void use_radix(Radix radix) { unit_radix = radix; }
+
+Radix current_radix(void) { return unit_radix; }
+
+int current_group(void) { return group_size; }
+
+typedef enum {
+  OP_LITERAL, // Copy text verbatim.
+  OP_OFFSET,  // Print the offset of the next unit.
+  OP_NUMBER,  // Print the current unit as a number.
+  OP_CHAR,    // Print the current unit as a character.
+} Op;
+
+typedef struct {
+  uint8_t op;
+  uint8_t radix;
+  uint8_t width;
+  bool zero;
+  bool upper;
+  bool is_signed;
+  uint32_t text;   // Start of a literal in the program's text.
+  uint32_t length; // Length of a literal.
+} Instruction;
+
+// A format string applied `count` times, consuming `size` bytes each time.
+typedef struct {
+  int count;
+  int size;
+  int first;
+  int end;
+} Block;
+
+struct FormatProgram {
+  char *spec; // The layout as given, to identify it.
+  Instruction *instructions;
+  int instruction_count;
+  Block *blocks;
+  int block_count;
+  char *text;
+  size_t text_length;
+  int line_length;
+  size_t max_output;
+};
+
+static FormatProgram *active_program = NULL;
+
+static void spec_error(const char *spec, const char *at, const char *reason) {
+  fprintf(stderr, "Error: Invalid format at column %d of '%s': %s\n",
+          (int)(at - spec) + 1, spec, reason);
+  exit(1);
+}
+
+static void *grow(void *array, int count, size_t element) {
+  // Arrays grow in powers of two, so grow when count is one.
+  if (count > 0 && (count & (count - 1)) != 0) {
+    return array;
+  }
+  array = realloc(array, element * (count > 0 ? 2 * count : 1));
+  if (array == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  return array;
+}
+
+static Instruction *add_instruction(FormatProgram *program, Op op) {
+  program->instructions =
+      grow(program->instructions, program->instruction_count,
+           sizeof(Instruction));
+  Instruction *instruction =
+      &program->instructions[program->instruction_count++];
+  memset(instruction, 0, sizeof(Instruction));
+  instruction->op = op;
+  return instruction;
+}
+
+static void add_text(FormatProgram *program, char c) {
+  program->text = grow(program->text, program->text_length, 1);
+  program->text[program->text_length++] = c;
+}
+
+// Widest number of the given size and radix, without padding.
+static int natural_width(int size, int radix, bool is_signed) {
+  static const int decimal[9] = {0, 3, 5, 0, 10, 0, 0, 0, 20};
+  switch (radix) {
+  case 16:
+    return 2 * size;
+  case 8:
+    return (8 * size + 2) / 3;
+  default:
+    return decimal[size] + is_signed;
+  }
+}
+
+// Parses one conversion after its '%' and adds its instruction. Returns a
+// pointer past the conversion.
+static const char *compile_conversion(FormatProgram *program, const char *spec,
+                                      const char *p, int size,
+                                      bool *has_unit) {
+  bool zero = false;
+  int width = 0;
+  if (*p == '0') {
+    zero = true;
+    p++;
+  }
+  while (*p >= '0' && *p <= '9') {
+    width = width * 10 + (*p++ - '0');
+    if (width > 64) {
+      spec_error(spec, p, "width is too large");
+    }
+  }
+
+  bool offset = false;
+  if (p[0] == '_' && p[1] == 'a') {
+    offset = true;
+    p += 2;
+  }
+
+  Instruction instruction;
+  memset(&instruction, 0, sizeof(instruction));
+  instruction.zero = zero;
+  instruction.upper = *p == 'X';
+  switch (*p) {
+  case 'x':
+  case 'X':
+    instruction.radix = 16;
+    break;
+  case 'o':
+    instruction.radix = 8;
+    break;
+  case 'd':
+    instruction.radix = 10;
+    instruction.is_signed = !offset;
+    break;
+  case 'u':
+    instruction.radix = 10;
+    break;
+  case 'c':
+    if (offset || size != 1) {
+      spec_error(spec, p, "%c needs 1-byte units");
+    }
+    break;
+  default:
+    spec_error(spec, p, "unknown conversion");
+  }
+
+  if (offset) {
+    instruction.op = OP_OFFSET;
+    instruction.width = width > 0 ? width : 8;
+    instruction.zero = zero || width == 0;
+  } else {
+    if (*has_unit) {
+      spec_error(spec, p, "only one conversion per format string");
+    }
+    *has_unit = true;
+    instruction.op = *p == 'c' ? OP_CHAR : OP_NUMBER;
+    instruction.width = width;
+  }
+  *add_instruction(program, instruction.op) = instruction;
+
+  int natural = instruction.op == OP_CHAR     ? GLYPH_MAX
+                : instruction.op == OP_OFFSET ? 22
+                           : natural_width(size, instruction.radix,
+                                           instruction.is_signed);
+  program->max_output += width > natural ? width : natural;
+  return p + 1;
+}
+
+// Parses a quoted format string and adds its instructions. Returns a
+// pointer past the closing quote.
+static const char *compile_string(FormatProgram *program, const char *spec,
+                                  const char *p, int size, bool *has_unit) {
+  int first = program->instruction_count;
+  p++;
+  while (*p != '"') {
+    if (*p == '\0') {
+      spec_error(spec, p, "missing closing quote");
+    }
+    if (p[0] == '%' && p[1] != '%') {
+      p = compile_conversion(program, spec, p + 1, size, has_unit);
+      continue;
+    }
+
+    char c = *p++;
+    if (c == '%') {
+      p++;
+    } else if (c == '\\') {
+      switch (*p++) {
+      case 'n':
+        c = '\n';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case '\\':
+        c = '\\';
+        break;
+      case '"':
+        c = '"';
+        break;
+      default:
+        spec_error(spec, p - 1, "unknown escape");
+      }
+    }
+
+    // Extend the previous literal if it ends where this text starts.
+    Instruction *last =
+        program->instruction_count > first
+            ? &program->instructions[program->instruction_count - 1]
+            : NULL;
+    if (last == NULL || last->op != OP_LITERAL ||
+        last->text + last->length != program->text_length) {
+      last = add_instruction(program, OP_LITERAL);
+      last->text = program->text_length;
+    }
+    add_text(program, c);
+    last->length++;
+    program->max_output++;
+  }
+  return p + 1;
+}
+
+FormatProgram *format_compile(const char *spec) {
+  FormatProgram *program = calloc(1, sizeof(FormatProgram));
+  if (program == NULL || (program->spec = strdup(spec)) == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  const char *p = spec;
+  while (true) {
+    while (*p == ' ' || *p == '\t' || *p == '\n') {
+      p++;
+    }
+    if (*p == '\0') {
+      break;
+    }
+
+    int count = 1;
+    int size = 1;
+    if (*p >= '0' && *p <= '9') {
+      char *end;
+      count = (int)strtol(p, &end, 10);
+      if (*end != '/' || count <= 0 || count > 4096) {
+        spec_error(spec, p, "expected count/size");
+      }
+      p = end + 1;
+      size = (int)strtol(p, &end, 10);
+      if (end == p || (size != 1 && size != 2 && size != 4 && size != 8)) {
+        spec_error(spec, p, "unit size must be 1, 2, 4 or 8");
+      }
+      p = end;
+      while (*p == ' ' || *p == '\t') {
+        p++;
+      }
+    }
+    if (*p != '"') {
+      spec_error(spec, p, "expected a quoted format string");
+    }
+
+    Block block = {count, size, program->instruction_count, 0};
+    size_t output_before = program->max_output;
+    bool has_unit = false;
+    p = compile_string(program, spec, p, size, &has_unit);
+    block.end = program->instruction_count;
+    if (!has_unit) {
+      block.size = 0;
+    }
+    program->max_output = output_before +
+                          (program->max_output - output_before) * count;
+    program->line_length += block.size * count;
+
+    program->blocks =
+        grow(program->blocks, program->block_count, sizeof(Block));
+    program->blocks[program->block_count++] = block;
+  }
+
+  if (program->line_length == 0) {
+    spec_error(spec, p, "the format consumes no bytes");
+  }
+  return program;
+}
+
+int format_program_length(FormatProgram *program) {
+  return program->line_length;
+}
+
+void use_format_program(FormatProgram *program) { active_program = program; }
+
+void format_free(FormatProgram *program) {
+  if (program != NULL) {
+    free(program->instructions);
+    free(program->blocks);
+    free(program->text);
+    free(program->spec);
+    free(program);
+  }
+}
+
+// Writes a number in the given radix, padded to at least `width` characters
+// with zeros or spaces.
+static char *put_number(char *p, uint64_t value, bool negative, int radix,
+                        int width, bool zero, bool upper) {
+  const char *digits = upper ? "0123456789ABCDEF" : hex_digits;
+  char reversed[24];
+  int length = 0;
+  do {
+    reversed[length++] = digits[value % radix];
+    value /= radix;
+  } while (value != 0);
+
+  int total = length + negative;
+  if (!zero) {
+    for (; total < width; total++) {
+      *p++ = ' ';
+    }
+  }
+  if (negative) {
+    *p++ = '-';
+  }
+  for (; total < width; total++) {
+    *p++ = '0';
+  }
+  while (length > 0) {
+    *p++ = reversed[--length];
+  }
+  return p;
+}
+
+static size_t run_program(char *out, const uint8_t *bytes, int num_bytes,
+                          uint64_t offset, int line_length) {
+  (void)line_length;
+  FormatProgram *program = active_program;
+  char *p = out;
+  int pos = 0;
+  for (int b = 0; b < program->block_count; b++) {
+    Block *block = &program->blocks[b];
+    for (int r = 0; r < block->count; r++) {
+      bool present = pos + block->size <= num_bytes;
+      for (int i = block->first; i < block->end; i++) {
+        Instruction *ins = &program->instructions[i];
+        switch (ins->op) {
+        case OP_LITERAL:
+          memcpy(p, program->text + ins->text, ins->length);
+          p += ins->length;
+          break;
+        case OP_OFFSET:
+          p = put_number(p, offset + pos, false, ins->radix, ins->width,
+                         ins->zero, ins->upper);
+          break;
+        case OP_NUMBER: {
+          int width = ins->width > 0
+                          ? ins->width
+                          : natural_width(block->size, ins->radix,
+                                          ins->is_signed);
+          if (!present) {
+            memset(p, ' ', width);
+            p += width;
+            break;
+          }
+          uint64_t value =
+              load_word(bytes + pos, block->size, group_big_endian);
+          bool negative = false;
+          if (ins->is_signed && block->size < 8 &&
+              (value >> (8 * block->size - 1)) != 0) {
+            value = (value ^ (((uint64_t)1 << (8 * block->size)) - 1)) + 1;
+            negative = true;
+          } else if (ins->is_signed && block->size == 8 &&
+                     (int64_t)value < 0) {
+            value = -value;
+            negative = true;
+          }
+          p = put_number(p, value, negative, ins->radix,
+                         ins->width > 0 ? ins->width : 0, ins->zero,
+                         ins->upper);
+          break;
+        }
+        case OP_CHAR: {
+          int width = ins->width > 1 ? ins->width : 1;
+          memset(p, ' ', width - 1);
+          p += width - 1;
+          if (present) {
+            memcpy(p, glyphs[bytes[pos]], GLYPH_MAX);
+            p += glyph_lengths[bytes[pos]];
+          } else {
+            *p++ = ' ';
+          }
+          break;
+        }
+        }
+      }
+      pos += block->size;
+    }
+  }
+  return p - out;
+}
+
+char *put_char(char *p, uint8_t byte) {
+  pthread_once(&tables_once, build_tables);
+  memcpy(p, glyphs[byte], GLYPH_MAX);
+  return p + glyph_lengths[byte];
+}
+
+void use_charset(const uint16_t code_points[256]) {
+  pthread_once(&tables_once, build_tables);
+  charset = code_points;
+  build_cells();
+}
+
+void use_colours(ColourScheme scheme) {
+  pthread_once(&tables_once, build_tables);
+  colour_scheme = scheme;
+  build_cells();
+}
+
+static int compare_ranges(const void *a, const void *b) {
+  const HighlightRange *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+void use_highlights(const bool values[256], HighlightRange *ranges,
+                    int count) {
+  pthread_once(&tables_once, build_tables);
+  memcpy(highlight_values, values, sizeof(highlight_values));
+  build_cells();
+
+  // Sort and merge the ranges so that a line finds the only ones that can
+  // touch it with a binary search.
+  qsort(ranges, count, sizeof(HighlightRange), compare_ranges);
+  int merged = 0;
+  for (int i = 0; i < count; i++) {
+    if (ranges[i].start >= ranges[i].end) {
+      continue;
+    }
+    if (merged > 0 && ranges[i].start <= ranges[merged - 1].end) {
+      if (ranges[i].end > ranges[merged - 1].end) {
+        ranges[merged - 1].end = ranges[i].end;
+      }
+    } else {
+      ranges[merged++] = ranges[i];
+    }
+  }
+  highlight_ranges = ranges;
+  highlight_count = merged;
+}
+
+// Returns the formatter for the byte-by-byte layout.
+static LineFormatter byte_formatter(int line_length) {
+  switch (line_length) {
+  case 8:
+    return format_line_8;
+  case 16:
+    return format_line_16;
+  case 32:
+    return format_line_32;
+  case 64:
+    return format_line_64;
+  default:
+    return format_generic;
+  }
+}
+
+// Formats a line in the byte-by-byte layout, marking the bytes that fall in
+// highlighted offset ranges. Lines without any go to the usual formatter.
+static size_t format_marked(char *out, const uint8_t *bytes, int num_bytes,
+                            uint64_t offset, int line_length) {
+  // Find the first range that ends after the start of the line.
+  int low = 0, high = highlight_count;
+  while (low < high) {
+    int mid = (low + high) / 2;
+    if (highlight_ranges[mid].end <= offset) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == highlight_count ||
+      highlight_ranges[low].start >= offset + num_bytes) {
+    return byte_formatter(line_length)(out, bytes, num_bytes, offset,
+                                       line_length);
+  }
+
+  // Both columns walk the ranges from the first one on the line, so no
+  // per-line record of the marked bytes is needed.
+  HighlightRange *first = &highlight_ranges[low];
+  HighlightRange *end = highlight_ranges + highlight_count;
+  HighlightRange *range = first;
+  char *p = put_offset(out, offset);
+  for (int i = 0; i < line_length; i++) {
+    if (i > 0 && i % 4 == 0) {
+      *p++ = ' ';
+    }
+    if (i < num_bytes) {
+      while (range < end && range->end <= offset + i) {
+        range++;
+      }
+      bool marked = range < end && range->start <= offset + i;
+      memcpy(p, marked ? marked_hex_cells[bytes[i]] : hex_cells[bytes[i]],
+             HEX_CELL_SIZE);
+      p += HEX_CELL_SIZE;
+    } else {
+      memcpy(p, "   ", 3);
+      p += 3;
+    }
+  }
+
+  memcpy(p, " | ", 3);
+  p += 3;
+  range = first;
+  for (int i = 0; i < num_bytes; i++) {
+    while (range < end && range->end <= offset + i) {
+      range++;
+    }
+    if (range < end && range->start <= offset + i) {
+      memcpy(p, marked_ascii_cells[bytes[i]], ASCII_CELL_SIZE);
+      p += marked_ascii_lengths[bytes[i]];
+    } else {
+      memcpy(p, ascii_cells[bytes[i]], ASCII_CELL_SIZE);
+      p += ascii_lengths[bytes[i]];
+    }
+  }
+  *p++ = '\n';
+  return p - out;
+}
+
+LineFormatter line_formatter(int line_length) {
+  pthread_once(&tables_once, build_tables);
+  if (active_program != NULL) {
+    return run_program;
+  }
+  if (unit_radix != RADIX_HEX) {
+    return format_radix;
+  }
+  if (group_size > 1) {
+    return format_grouped;
+  }
+  if (highlight_count > 0) {
+    return format_marked;
+  }
+  return byte_formatter(line_length);
+}
+
+bool is_unrolled_length(int line_length) {
+  return active_program == NULL && unit_radix == RADIX_HEX &&
+         group_size == 1 && byte_formatter(line_length) != format_generic;
+}
+
+uint64_t format_fingerprint(void) {
+  pthread_once(&tables_once, build_tables);
+  // The cell tables hold the colours and the character set.
+  uint64_t hash = hash64(hex_cells, sizeof(hex_cells), 0);
+  hash = hash64(ascii_cells, sizeof(ascii_cells), hash);
+  hash = hash64(ascii_lengths, sizeof(ascii_lengths), hash);
+  hash = hash64(highlight_values, sizeof(highlight_values), hash);
+  hash = hash64(highlight_ranges, sizeof(HighlightRange) * highlight_count,
+                hash);
+  int settings[] = {group_size, group_big_endian, unit_radix, colour_scheme};
+  hash = hash64(settings, sizeof(settings), hash);
+  if (active_program != NULL) {
+    hash = hash64(active_program->spec, strlen(active_program->spec), hash);
+  }
+  return hash;
+}
+
+size_t line_text_size(int line_length) {
+  // A binary cell of one byte is the widest: 21 characters plus a gap and
+  // an ASCII cell.
+  size_t size = (unit_radix == RADIX_HEX ? 29 : 36) * (size_t)line_length + 48;
+  if (active_program != NULL && active_program->max_output + 1 > size) {
+    size = active_program->max_output + 1;
+  }
+  return size;
+}
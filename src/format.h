@@ -0,0 +1,142 @@
+#ifndef format_h
+#define format_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes one line of output to `out`: the offset, up to line_length bytes in
+// hexadecimal, and their ASCII representation, ending with a newline.
+// Returns the number of characters written, without a terminating NUL.
+typedef size_t (*LineFormatter)(char *out, const uint8_t *bytes,
+                                int num_bytes, uint64_t offset,
+                                int line_length);
+
+// Returns the formatter for lines of line_length bytes. Common widths get a
+// fully unrolled formatter for complete lines; everything else, including
+// the partial line at the end of the input, takes the generic path. Pick the
+// formatter once and reuse it for every line.
+LineFormatter line_formatter(int line_length);
+
+// Returns true if line_formatter has an unrolled formatter for lines of
+// line_length bytes with the current settings.
+bool is_unrolled_length(int line_length);
+
+// Makes every line formatter print the hex column as words of `group` bytes
+// (1, 2, 4 or 8), each read in little- or big-endian order. A group of 1 is
+// the default byte-by-byte layout.
+void use_grouping(int group, bool big_endian);
+
+// Radix of the units in the hex column.
+typedef enum {
+  RADIX_HEX,
+  RADIX_OCTAL,
+  RADIX_DECIMAL, // Unsigned decimal.
+  RADIX_SIGNED,  // Signed decimal.
+  RADIX_BINARY,
+  RADIX_FLOAT, // IEEE 754 floats of 4 or 8 bytes.
+} Radix;
+
+// Makes every line formatter print the units set by use_grouping in the
+// given radix. Octal and binary units are zero-padded and decimal units
+// right-aligned, all to the width of the largest value of their size.
+// Floats are printed in the fewest digits that read back as the same value.
+void use_radix(Radix radix);
+
+// Returns the number of characters needed for any unit of 1 to 8 bytes in
+// the given radix.
+int unit_width(Radix radix, int size);
+
+// Looks up a unit type of --as and record layouts: u8, i8, u16, i16, u32,
+// i32, u64, i64, f32 or f64. Returns false for any other name.
+bool try_parse_type(const char *name, int *size, Radix *radix);
+
+// Return the radix and the bytes per unit set by use_radix and use_grouping.
+Radix current_radix(void);
+int current_group(void);
+
+// Writes the offset of a line in the offset colour as at least 8 hex digits,
+// followed by a space. Returns a pointer past the written text.
+char *put_offset(char *p, uint64_t offset);
+
+// Writes a unit of `size` bytes, read in the given byte order, in the given
+// radix and padded to unit_width(radix, size), without colour. Returns a
+// pointer past the written text.
+char *put_value(char *p, const uint8_t *bytes, int size, Radix radix,
+                bool big_endian);
+
+// Colouring of the hex and ASCII columns.
+typedef enum {
+  COLOUR_DEFAULT, // Red hex bytes and blue printable characters.
+  COLOUR_CLASSES, // A colour per byte class: NUL, printable, whitespace,
+                  // control and high-bit bytes.
+} ColourScheme;
+
+// Switches the colour scheme of every line formatter. Must be called before
+// any line is formatted. Words printed with -g, -r or --as keep the default
+// colour, as their bytes may fall in different classes.
+void use_colours(ColourScheme scheme);
+
+// Shows each byte value in the text column as the character with the given
+// Unicode code point (below 0x10000), encoded in UTF-8, or as '.' if its
+// code point is 0. The array must stay alive. Must be called before any line
+// is formatted.
+void use_charset(const uint16_t code_points[256]);
+
+// Most bytes put_char writes for one character.
+#define GLYPH_MAX 3
+
+// Writes the character the text column shows for a byte, in the character
+// set chosen with use_charset, without colour. Writes up to GLYPH_MAX bytes
+// and returns a pointer past the character.
+char *put_char(char *p, uint8_t byte);
+
+// A range of input offsets [start, end).
+typedef struct {
+  uint64_t start;
+  uint64_t end;
+} HighlightRange;
+
+// Highlights in reverse video every byte whose value is set in `values` and
+// every byte within the given offset ranges, which may overlap and come in
+// any order. The ranges array is sorted and merged in place and must stay
+// alive. Byte values cost nothing per byte, as they are baked into the
+// cells; ranges cost one lookup per line. Offset ranges only apply to the
+// byte-by-byte layout. Must be called before any line is formatted.
+void use_highlights(const bool values[256], HighlightRange *ranges,
+                    int count);
+
+// Returns a hash of every setting that changes how lines are formatted, to
+// tell whether text formatted earlier can be reused.
+uint64_t format_fingerprint(void);
+
+// Returns the size of a buffer that can hold any formatted line of
+// line_length bytes.
+size_t line_text_size(int line_length);
+
+// A user-defined line layout compiled into a list of instructions.
+typedef struct FormatProgram FormatProgram;
+
+// Compiles a layout in the style of `hexdump -e`: a sequence of quoted
+// format strings, each optionally preceded by `count/size` to apply it to
+// `count` units of `size` (1, 2, 4 or 8) bytes. A format string holds
+// literal text, with \n, \t, \\ and \" escapes, and at most one
+// conversion of a unit: %x, %X, %o, %d, %u or %c (the unit's character as
+// put_char writes it), with an optional 0 flag and width. The conversions
+// %_ax, %_ad and %_ao print the offset of the next unit and may appear
+// anywhere. Units are read in the byte order given to use_grouping. Exits
+// with an error message if the layout is invalid.
+FormatProgram *format_compile(const char *spec);
+
+// Returns the number of bytes a compiled layout consumes per line.
+int format_program_length(FormatProgram *program);
+
+// Makes every line formatter run the given layout instead of the built-in
+// one, until called again with NULL. Callers must then use the layout's line
+// length.
+void use_format_program(FormatProgram *program);
+
+// Free the memory associated with a compiled layout.
+void format_free(FormatProgram *program);
+
+#endif
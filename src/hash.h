@@ -0,0 +1,32 @@
+#ifndef hash_h
+#define hash_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hashes a block of memory using the XXH64 algorithm.
+uint64_t hash64(const void *data, size_t length, uint64_t seed);
+
+// An rsync-style rolling checksum over a fixed-size window. The window can be
+// slid forward one byte at a time in constant time.
+typedef struct {
+  uint32_t a;
+  uint32_t b;
+  size_t window;
+} RollSum;
+
+// Initializes the checksum over the first `window` bytes of data.
+void rollsum_init(RollSum *sum, const uint8_t *data, size_t window);
+
+// Slides the window forward by one byte, dropping `out` and adding `in`.
+static inline void rollsum_roll(RollSum *sum, uint8_t out, uint8_t in) {
+  sum->a += in - out;
+  sum->b += sum->a - sum->window * out;
+}
+
+// Returns the current 32-bit checksum value.
+static inline uint32_t rollsum_digest(const RollSum *sum) {
+  return (sum->a & 0xffff) | (sum->b << 16);
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "highlight.h"
+#include "format.h"
+#include "io.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Bytes of input scanned at a time for search rules.
+#define HIGHLIGHT_CHUNK_SIZE (1 << 20)
+
+// Longest search pattern.
+#define HIGHLIGHT_MAX_PATTERN 256
+
+typedef struct {
+  HighlightRange *ranges;
+  int count;
+  int capacity;
+} RangeList;
+
+static void add_range(RangeList *list, uint64_t start, uint64_t end) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity > 0 ? 2 * list->capacity : 16;
+    list->ranges =
+        realloc(list->ranges, sizeof(HighlightRange) * list->capacity);
+    if (list->ranges == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+  }
+  list->ranges[list->count++] = (HighlightRange){start, end};
+}
+
+static void invalid_rule(const char *rule) {
+  fprintf(stderr, "Error: Invalid highlight '%s'\n", rule);
+  exit(1);
+}
+
+// Adds a range for every occurrence of the pattern in the input. Chunks
+// overlap by one byte less than the pattern, so that matches across chunk
+// boundaries are found exactly once.
+static void find_matches(RangeList *list, int fd, const uint8_t *pattern,
+                         size_t length, uint64_t start, int64_t limit) {
+  size_t size = HIGHLIGHT_CHUNK_SIZE + length - 1;
+  uint8_t *chunk = malloc(size);
+  if (chunk == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  uint64_t pos = start;
+  uint64_t end = limit >= 0 ? start + limit : UINT64_MAX;
+  while (pos < end) {
+    size_t wanted = end - pos < size ? (size_t)(end - pos) : size;
+    size_t got = read_at(fd, chunk, wanted, pos);
+    if (got < length) {
+      break;
+    }
+    uint8_t *p = chunk;
+    uint8_t *last = chunk + got;
+    while ((p = memmem(p, last - p, pattern, length)) != NULL) {
+      add_range(list, pos + (p - chunk), pos + (p - chunk) + length);
+      p++;
+    }
+    if (got < wanted) {
+      break;
+    }
+    pos += got - (length - 1);
+  }
+  free(chunk);
+}
+
+void use_highlight_rules(char **rules, int count, const char *path,
+                         uint64_t start, int64_t length) {
+  bool values[256] = {false};
+  RangeList list = {NULL, 0, 0};
+  int fd = -1;
+
+  for (int i = 0; i < count; i++) {
+    char *rule = rules[i];
+    if (rule[0] == '@') {
+      char *colon = strchr(rule, ':');
+      int64_t range_start, range_length;
+      if (colon == NULL) {
+        invalid_rule(rule);
+      }
+      *colon = '\0';
+      bool ok = try_parse_size(rule + 1, &range_start) &&
+                try_parse_size(colon + 1, &range_length) &&
+                range_start >= 0 && range_length >= 0;
+      *colon = ':';
+      if (!ok) {
+        invalid_rule(rule);
+      }
+      add_range(&list, range_start, range_start + range_length);
+    } else if (rule[0] == '/') {
+      uint8_t pattern[HIGHLIGHT_MAX_PATTERN];
+      size_t pattern_length;
+      if (!try_parse_pattern(rule + 1, pattern, sizeof(pattern),
+                             &pattern_length)) {
+        invalid_rule(rule);
+      }
+      if (fd < 0) {
+        fd = path != NULL ? open(path, O_RDONLY) : -1;
+        if (fd < 0) {
+          fprintf(stderr, "Error: Search highlights require a file\n");
+          exit(1);
+        }
+      }
+      find_matches(&list, fd, pattern, pattern_length, start, length);
+    } else {
+      // A byte value or range, in decimal or with a 0x prefix in hex.
+      char *end;
+      long low = strtol(rule, &end, 0);
+      long high = low;
+      bool ok = end != rule;
+      if (ok && *end == '-') {
+        char *from = end + 1;
+        high = strtol(from, &end, 0);
+        ok = end != from;
+      }
+      if (!ok || *end != '\0' || low < 0 || high > 255 || low > high) {
+        invalid_rule(rule);
+      }
+      for (int b = low; b <= high; b++) {
+        values[b] = true;
+      }
+    }
+  }
+
+  if (fd >= 0) {
+    close(fd);
+  }
+  // The formatters keep the ranges for the rest of the run.
+  use_highlights(values, list.ranges, list.count);
+}
@@ -0,0 +1,20 @@
+#ifndef highlight_h
+#define highlight_h
+
+#include <stdint.h>
+
+// Parses --highlight rules and hands them to the line formatters. A rule is
+// one of:
+//
+//   <byte> or <byte>-<byte>   byte values, e.g. 0xff or 0x80-0xff
+//   @<start>:<len>            an offset range, e.g. @0x200:64
+//   /<text> or /0x<hex>       every occurrence of text or hex bytes
+//
+// Search rules scan the input at `path` once, from `start` onwards and for
+// `length` bytes if it is not negative, and highlight the matches as offset
+// ranges. Exits with an error message if a rule is malformed or a search
+// rule has no file to scan.
+void use_highlight_rules(char **rules, int count, const char *path,
+                         uint64_t start, int64_t length);
+
+#endif
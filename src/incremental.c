@@ -0,0 +1,250 @@
+#include "incremental.h"
+#include "dump.h"
+#include "format.h"
+#include "io.h"
+#include "merkle.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes per hashed block, rounded down to a whole number of lines so that
+// every block's text can be reused on its own.
+#define INCREMENTAL_BLOCK_SIZE (64 << 10)
+
+// Identifies a cached output file and its format version.
+#define CACHE_MAGIC "DMPCACH2"
+
+// A cached output file holds this header, then block_count + 1 offsets into
+// the text that follows, so that block i's text is [offsets[i],
+// offsets[i + 1]). The root hash ties the cache to the state it belongs to,
+// and the format fingerprint to the options the text was formatted with.
+typedef struct {
+  char magic[8];
+  uint32_t line_length;
+  uint32_t block_size;
+  uint64_t block_count;
+  uint64_t root;
+  uint64_t format;
+} CacheHeader;
+
+typedef struct {
+  FILE *file;
+  uint64_t *offsets;
+  uint64_t text_start;
+} Cache;
+
+static uint64_t tree_root(MerkleTree *tree) {
+  return tree->counts[0] > 0 ? tree->level[tree->levels - 1][0] : 0;
+}
+
+// Opens the previous run's cached output. Returns false if it is missing or
+// does not match the previous state, line length and output format.
+static bool cache_open(Cache *cache, const char *path, MerkleTree *state,
+                       int line_length) {
+  cache->file = fopen(path, "rb");
+  cache->offsets = NULL;
+  if (cache->file == NULL) {
+    return false;
+  }
+
+  CacheHeader header;
+  bool ok = fread(&header, sizeof(header), 1, cache->file) == 1 &&
+            memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+            header.line_length == (uint32_t)line_length &&
+            header.block_size == state->block_size &&
+            header.block_count == state->counts[0] &&
+            header.root == tree_root(state) &&
+            header.format == format_fingerprint();
+
+  if (ok) {
+    uint64_t count = header.block_count + 1;
+    cache->offsets = malloc(sizeof(uint64_t) * count);
+    ok = cache->offsets != NULL &&
+         fread(cache->offsets, sizeof(uint64_t), count, cache->file) == count;
+    cache->text_start = sizeof(header) + sizeof(uint64_t) * count;
+  }
+
+  if (!ok) {
+    fclose(cache->file);
+    free(cache->offsets);
+    cache->file = NULL;
+    cache->offsets = NULL;
+  }
+  return ok;
+}
+
+static void cache_close(Cache *cache) {
+  if (cache->file != NULL) {
+    fclose(cache->file);
+  }
+  free(cache->offsets);
+}
+
+// Returns a freshly-allocated copy of a cached block's text.
+static char *cache_text(Cache *cache, uint64_t block, size_t *length) {
+  uint64_t start = cache->offsets[block];
+  *length = cache->offsets[block + 1] - start;
+  char *text = malloc(*length > 0 ? *length : 1);
+  if (text == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  if (read_at(fileno(cache->file), (uint8_t *)text, *length,
+              cache->text_start + start) != *length) {
+    fprintf(stderr, "Error: Cached output is truncated\n");
+    exit(1);
+  }
+  return text;
+}
+
+// Formats one block of the input into a freshly-allocated string.
+static char *format_block(int fd, uint8_t *buffer, uint64_t block,
+                          uint32_t block_size, int line_length,
+                          size_t *length) {
+  uint64_t pos = block * block_size;
+  size_t num_bytes = read_at(fd, buffer, block_size, pos);
+
+  char *text;
+  FILE *mem = open_memstream(&text, length);
+  if (mem == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  print_lines(mem, buffer, num_bytes, pos, line_length);
+  fclose(mem);
+  return text;
+}
+
+uint64_t dump_incremental(FILE *out, int fd, const char *state_path,
+                          const char *cache_path, int line_length,
+                          int threads) {
+  uint32_t block_size =
+      INCREMENTAL_BLOCK_SIZE - INCREMENTAL_BLOCK_SIZE % line_length;
+  if (block_size == 0) {
+    block_size = line_length;
+  }
+
+  MerkleTree *old = merkle_load(state_path);
+  if (old != NULL && old->block_size != block_size) {
+    merkle_free(old);
+    old = NULL;
+  }
+
+  Cache cache = {NULL, NULL, 0};
+  bool reuse = old != NULL && cache_path != NULL &&
+               cache_open(&cache, cache_path, old, line_length);
+
+  // Nothing has been written to the file since the last run.
+  if (old != NULL && merkle_is_current(old, fd) &&
+      (cache_path == NULL || reuse)) {
+    for (uint64_t b = 0; reuse && b < old->counts[0]; b++) {
+      size_t length;
+      char *text = cache_text(&cache, b, &length);
+      fwrite(text, 1, length, out);
+      free(text);
+    }
+    cache_close(&cache);
+    merkle_free(old);
+    return 0;
+  }
+
+  MerkleTree *tree = merkle_build(fd, block_size, threads);
+  uint64_t block_count = tree->counts[0];
+
+  bool *changed = malloc(block_count > 0 ? block_count : 1);
+  uint8_t *buffer = malloc(block_size);
+  if (changed == NULL || buffer == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  memset(changed, old == NULL, block_count);
+  if (old != NULL) {
+    uint64_t *blocks;
+    uint64_t count = merkle_diff(old, tree, &blocks);
+    for (uint64_t i = 0; i < count; i++) {
+      if (blocks[i] < block_count) {
+        changed[blocks[i]] = true;
+      }
+    }
+    free(blocks);
+  }
+
+  // Write the new cache alongside the old one and swap it in at the end.
+  FILE *new_cache = NULL;
+  char *new_cache_path = NULL;
+  uint64_t *offsets = NULL;
+  if (cache_path != NULL) {
+    new_cache_path = malloc(strlen(cache_path) + sizeof(".tmp"));
+    offsets = malloc(sizeof(uint64_t) * (block_count + 1));
+    if (new_cache_path == NULL || offsets == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+    strcpy(new_cache_path, cache_path);
+    strcat(new_cache_path, ".tmp");
+    new_cache = fopen(new_cache_path, "wb");
+    if (new_cache == NULL) {
+      fprintf(stderr, "Error: Could not write cache '%s'\n", new_cache_path);
+      exit(1);
+    }
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.line_length = line_length;
+    header.block_size = block_size;
+    header.block_count = block_count;
+    header.root = tree_root(tree);
+    header.format = format_fingerprint();
+    fwrite(&header, sizeof(header), 1, new_cache);
+    fseeko(new_cache, sizeof(uint64_t) * (block_count + 1), SEEK_CUR);
+  }
+
+  uint64_t changed_count = 0;
+  uint64_t text_pos = 0;
+  for (uint64_t b = 0; b < block_count; b++) {
+    changed_count += changed[b];
+    if (!changed[b] && new_cache == NULL) {
+      continue;
+    }
+
+    size_t length;
+    char *text = changed[b] || !reuse
+                     ? format_block(fd, buffer, b, block_size, line_length,
+                                    &length)
+                     : cache_text(&cache, b, &length);
+    fwrite(text, 1, length, out);
+    if (new_cache != NULL) {
+      offsets[b] = text_pos;
+      fwrite(text, 1, length, new_cache);
+      text_pos += length;
+    }
+    free(text);
+  }
+
+  if (new_cache != NULL) {
+    offsets[block_count] = text_pos;
+    fseeko(new_cache, sizeof(CacheHeader), SEEK_SET);
+    fwrite(offsets, sizeof(uint64_t), block_count + 1, new_cache);
+    if (ferror(new_cache) || fclose(new_cache) != 0 ||
+        rename(new_cache_path, cache_path) != 0) {
+      fprintf(stderr, "Error: Could not write cache '%s'\n", cache_path);
+      exit(1);
+    }
+  }
+
+  if (!merkle_save(tree, state_path)) {
+    fprintf(stderr, "Error: Could not write state '%s'\n", state_path);
+    exit(1);
+  }
+
+  cache_close(&cache);
+  merkle_free(old);
+  merkle_free(tree);
+  free(changed);
+  free(buffer);
+  free(offsets);
+  free(new_cache_path);
+  return changed_count;
+}
@@ -0,0 +1,20 @@
+#ifndef incremental_h
+#define incremental_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Dumps only the lines of the blocks that changed since the previous run, as
+// recorded by the block hashes in the state file, then updates the state. An
+// unchanged size and modification time skips the file entirely.
+//
+// If cache_path is not NULL the complete dump is written instead: the text of
+// unchanged blocks is copied from the previous run's cached output and only
+// changed blocks are formatted, after which the cache is updated.
+//
+// Returns the number of changed blocks.
+uint64_t dump_incremental(FILE *out, int fd, const char *state_path,
+                          const char *cache_path, int line_length,
+                          int threads);
+
+#endif
@@ -0,0 +1,337 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "io.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Bytes moved per splice() or read() call when skipping input.
+#define SKIP_CHUNK_SIZE (1 << 20)
+
+bool try_parse_size(const char *string, int64_t *value) {
+  char *end;
+  errno = 0;
+  long long number = strtoll(string, &end, 0);
+  int shift = 0;
+  switch (toupper((unsigned char)*end)) {
+  case 'K':
+    shift = 10;
+    break;
+  case 'M':
+    shift = 20;
+    break;
+  case 'G':
+    shift = 30;
+    break;
+  case 'T':
+    shift = 40;
+    break;
+  }
+  if (shift > 0) {
+    end++;
+  }
+  if (end == string || *end != '\0' || errno == ERANGE ||
+      number > (INT64_MAX >> shift) || number < (INT64_MIN >> shift)) {
+    return false;
+  }
+  *value = (int64_t)number * ((int64_t)1 << shift);
+  return true;
+}
+
+bool try_parse_pattern(const char *input, uint8_t *pattern, size_t capacity,
+                       size_t *length) {
+  size_t count = 0;
+  if (strncmp(input, "0x", 2) == 0) {
+    for (const char *c = input + 2; *c != '\0'; c++) {
+      if (isspace((unsigned char)*c)) {
+        continue;
+      }
+      if (!isxdigit((unsigned char)c[0]) || !isxdigit((unsigned char)c[1]) ||
+          count == capacity) {
+        return false;
+      }
+      char hex[3] = {c[0], c[1], '\0'};
+      pattern[count++] = (uint8_t)strtol(hex, NULL, 16);
+      c++;
+    }
+  } else {
+    count = strlen(input);
+    if (count > capacity) {
+      return false;
+    }
+    memcpy(pattern, input, count);
+  }
+  *length = count;
+  return count > 0;
+}
+
+bool try_read_at(int fd, uint8_t *buffer, size_t length, uint64_t pos,
+                 size_t *num_bytes) {
+  size_t total = 0;
+  while (total < length) {
+    ssize_t n = pread(fd, buffer + total, length - total, pos + total);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      *num_bytes = total;
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += n;
+  }
+  *num_bytes = total;
+  return true;
+}
+
+size_t read_at(int fd, uint8_t *buffer, size_t length, uint64_t pos) {
+  size_t total;
+  if (!try_read_at(fd, buffer, length, pos, &total)) {
+    fprintf(stderr, "Error: Could not read input at offset %llu\n",
+            (unsigned long long)(pos + total));
+    exit(1);
+  }
+  return total;
+}
+
+bool input_size(int fd, uint64_t *size) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return false;
+  }
+  if (S_ISREG(st.st_mode)) {
+    *size = st.st_size;
+    return true;
+  }
+
+  // Block devices report a size of 0 but can seek to their end.
+  off_t position = lseek(fd, 0, SEEK_CUR);
+  off_t end = lseek(fd, 0, SEEK_END);
+  if (position < 0 || end < 0) {
+    return false;
+  }
+  lseek(fd, position, SEEK_SET);
+  *size = end;
+  return true;
+}
+
+bool write_all(int fd, const void *data, size_t length) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  while (length > 0) {
+    ssize_t n = write(fd, bytes, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    bytes += n;
+    length -= n;
+  }
+  return true;
+}
+
+// Discards input by reading it into a scratch buffer.
+static uint64_t skip_by_reading(int fd, uint64_t length) {
+  uint8_t *scratch = malloc(SKIP_CHUNK_SIZE);
+  if (scratch == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  uint64_t skipped = 0;
+  while (skipped < length) {
+    size_t want = length - skipped < SKIP_CHUNK_SIZE ? length - skipped
+                                                     : SKIP_CHUNK_SIZE;
+    ssize_t n = read(fd, scratch, want);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      fprintf(stderr, "Error: Could not read input\n");
+      exit(1);
+    }
+    if (n == 0) {
+      break;
+    }
+    skipped += n;
+  }
+
+  free(scratch);
+  return skipped;
+}
+
+uint64_t skip_input(int fd, uint64_t length) {
+  uint64_t skipped = 0;
+
+#ifdef __linux__
+  // splice() needs one end to be a pipe, so it fails with EINVAL for other
+  // inputs such as terminals and sockets, leaving the reading fallback.
+  int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  while (null_fd >= 0 && skipped < length) {
+    size_t want = length - skipped < SKIP_CHUNK_SIZE ? length - skipped
+                                                     : SKIP_CHUNK_SIZE;
+    ssize_t n = splice(fd, NULL, null_fd, NULL, want, SPLICE_F_MOVE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      break;
+    }
+    if (n == 0) {
+      close(null_fd);
+      return skipped;
+    }
+    skipped += n;
+  }
+  if (null_fd >= 0) {
+    close(null_fd);
+  }
+#endif
+
+  return skipped + skip_by_reading(fd, length - skipped);
+}
+
+int64_t file_mtime(const struct stat *st) {
+  return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+void file_cache_init(FileCache *cache, int capacity) {
+  memset(cache, 0, sizeof(FileCache));
+  cache->capacity = capacity > 0 ? capacity : 1;
+  cache->files = malloc(sizeof(OpenFile *) * cache->capacity);
+  if (cache->files == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  pthread_mutex_init(&cache->lock, NULL);
+}
+
+static void open_file_free(OpenFile *file) {
+  close(file->fd);
+  free(file->path);
+  free(file);
+}
+
+void file_cache_destroy(FileCache *cache) {
+  for (int i = 0; i < cache->count; i++) {
+    open_file_free(cache->files[i]);
+  }
+  free(cache->files);
+  pthread_mutex_destroy(&cache->lock);
+}
+
+static bool is_current(OpenFile *file, struct stat *st) {
+  return file->dev == st->st_dev && file->ino == st->st_ino &&
+         file->mtime == file_mtime(st) &&
+         (!S_ISREG(st->st_mode) || file->size == (uint64_t)st->st_size);
+}
+
+// Drops entry i from the cache, freeing it unless it is still in use.
+static void cache_remove(FileCache *cache, int i) {
+  OpenFile *file = cache->files[i];
+  cache->files[i] = cache->files[--cache->count];
+  file->cached = false;
+  if (file->users == 0) {
+    open_file_free(file);
+  }
+}
+
+// Opens a file or block device. Returns NULL with errno set on failure.
+static OpenFile *open_file_new(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  uint64_t size;
+  bool found = fstat(fd, &st) == 0;
+  if (!found || !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) ||
+      !input_size(fd, &size)) {
+    int error = !found ? errno : S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+    close(fd);
+    errno = error;
+    return NULL;
+  }
+
+  OpenFile *file = calloc(1, sizeof(OpenFile));
+  if (file == NULL || (file->path = strdup(path)) == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  file->fd = fd;
+  file->size = size;
+  file->dev = st.st_dev;
+  file->ino = st.st_ino;
+  file->mtime = file_mtime(&st);
+  return file;
+}
+
+OpenFile *file_cache_acquire(FileCache *cache, const char *path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  OpenFile *file = NULL;
+  for (int i = 0; i < cache->count; i++) {
+    if (strcmp(cache->files[i]->path, path) == 0) {
+      if (is_current(cache->files[i], &st)) {
+        file = cache->files[i];
+      } else {
+        cache_remove(cache, i);
+      }
+      break;
+    }
+  }
+
+  if (file == NULL) {
+    file = open_file_new(path);
+    if (file == NULL) {
+      int error = errno;
+      pthread_mutex_unlock(&cache->lock);
+      errno = error;
+      return NULL;
+    }
+    if (cache->count == cache->capacity) {
+      int oldest = -1;
+      for (int i = 0; i < cache->count; i++) {
+        if (cache->files[i]->users == 0 &&
+            (oldest < 0 ||
+             cache->files[i]->last_used < cache->files[oldest]->last_used)) {
+          oldest = i;
+        }
+      }
+      if (oldest >= 0) {
+        cache_remove(cache, oldest);
+      }
+    }
+    if (cache->count < cache->capacity) {
+      cache->files[cache->count++] = file;
+      file->cached = true;
+    }
+  }
+
+  file->users++;
+  file->last_used = cache->clock++;
+  pthread_mutex_unlock(&cache->lock);
+  return file;
+}
+
+void file_cache_release(FileCache *cache, OpenFile *file) {
+  pthread_mutex_lock(&cache->lock);
+  if (--file->users == 0 && !file->cached) {
+    open_file_free(file);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
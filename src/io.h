@@ -0,0 +1,90 @@
+#ifndef io_h
+#define io_h
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Reads up to `length` bytes at position `pos` of a file descriptor, retrying
+// short reads. Returns the number of bytes read, which is only less than
+// `length` at the end of the file. Exits with an error message on failure.
+size_t read_at(int fd, uint8_t *buffer, size_t length, uint64_t pos);
+
+// Like read_at, but stores the number of bytes read in *num_bytes and
+// returns false with errno set on failure instead of exiting.
+bool try_read_at(int fd, uint8_t *buffer, size_t length, uint64_t pos,
+                 size_t *num_bytes);
+
+// Finds the size of a file or block device and stores it in *size, leaving
+// the file position unchanged. Returns false for inputs whose size cannot be
+// found, such as pipes.
+bool input_size(int fd, uint64_t *size);
+
+// Returns a file's modification time in nanoseconds.
+int64_t file_mtime(const struct stat *st);
+
+// A file or block device opened through a FileCache. It stays open while any
+// user holds it, even after it has been evicted or replaced in the cache.
+typedef struct {
+  char *path;
+  int fd;
+  uint64_t size;
+  // The identity and version of the file when it was opened.
+  dev_t dev;
+  ino_t ino;
+  int64_t mtime;
+  int users;
+  uint64_t last_used;
+  bool cached;
+} OpenFile;
+
+// Recently used input files, kept open for reuse and shared by threads.
+typedef struct {
+  OpenFile **files;
+  int count;
+  int capacity;
+  uint64_t clock;
+  pthread_mutex_t lock;
+} FileCache;
+
+// Initializes a cache that keeps up to `capacity` files open.
+void file_cache_init(FileCache *cache, int capacity);
+
+// Closes every cached file. None may still be in use.
+void file_cache_destroy(FileCache *cache);
+
+// Returns the open file or block device at path, reusing a cached one unless
+// the file has been replaced or modified since it was opened. The least
+// recently used file not in use makes room; if every file is in use, the
+// file is opened just for this user. Returns NULL with errno set if it
+// cannot be opened or is something else, such as a directory.
+OpenFile *file_cache_acquire(FileCache *cache, const char *path);
+
+// Hands a file back to the cache, closing it if it is no longer cached.
+void file_cache_release(FileCache *cache, OpenFile *file);
+
+// Writes all `length` bytes to a file descriptor, retrying short writes.
+// Returns false if the write fails, e.g. because the reader has gone away.
+bool write_all(int fd, const void *data, size_t length);
+
+// Discards up to `length` bytes from a file descriptor that cannot seek, such
+// as a pipe. Where possible the data is spliced straight into /dev/null
+// without being copied to user space; otherwise it is read into a scratch
+// buffer in large chunks. Returns the number of bytes discarded, which is
+// only less than `length` at the end of the input.
+uint64_t skip_input(int fd, uint64_t length);
+
+// Parses a byte count such as 4096, 0x1000, 64K or 10G, where the K, M, G
+// and T suffixes are powers of 1024. Returns false if the string is not a
+// valid byte count or is out of range.
+bool try_parse_size(const char *string, int64_t *value);
+
+// Parses a search pattern into at most `capacity` bytes: hex bytes, which may
+// be separated by spaces, if it starts with 0x, and literal text otherwise.
+// Returns false if the pattern is empty, malformed or too long.
+bool try_parse_pattern(const char *input, uint8_t *pattern, size_t capacity,
+                       size_t *length);
+
+#endif
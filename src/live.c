@@ -0,0 +1,83 @@
+#include "live.h"
+#include "dump.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Largest chunk read from the stream at once.
+#define LIVE_BUFFER_SIZE (64 << 10)
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void dump_live(FILE *out, int fd, uint64_t offset, int64_t bytes_to_read,
+               int line_length, bool timestamps) {
+  uint8_t *buffer = (uint8_t *)malloc(LIVE_BUFFER_SIZE);
+  if (buffer == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  // The flags are restored afterwards, as the file description may be
+  // shared with other processes, e.g. the shell that owns the terminal.
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    fprintf(stderr, "Error: Could not make input non-blocking\n");
+    exit(1);
+  }
+
+  uint64_t start = monotonic_ns();
+  struct pollfd pfd = {fd, POLLIN, 0};
+
+  while (bytes_to_read != 0) {
+    size_t max_bytes = LIVE_BUFFER_SIZE;
+    if (bytes_to_read > 0 && bytes_to_read < LIVE_BUFFER_SIZE) {
+      max_bytes = bytes_to_read;
+    }
+
+    ssize_t num_bytes = read(fd, buffer, max_bytes);
+    if (num_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+        fprintf(stderr, "Error: Could not poll input\n");
+        exit(1);
+      }
+      continue;
+    }
+    if (num_bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (num_bytes < 0) {
+      fprintf(stderr, "Error: Could not read input\n");
+      exit(1);
+    }
+    if (num_bytes == 0) {
+      break;
+    }
+
+    if (timestamps) {
+      uint64_t elapsed = monotonic_ns() - start;
+      fprintf(out, "\033[0;32m[%5llu.%06llu]\033[0m\n",
+              (unsigned long long)(elapsed / 1000000000),
+              (unsigned long long)(elapsed % 1000000000 / 1000));
+    }
+    print_lines(out, buffer, num_bytes, offset, line_length);
+    fflush(out);
+
+    offset += num_bytes;
+    if (bytes_to_read > 0) {
+      bytes_to_read -= num_bytes;
+    }
+  }
+
+  fcntl(fd, F_SETFL, flags);
+  free(buffer);
+}
@@ -0,0 +1,17 @@
+#ifndef live_h
+#define live_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Dumps a stream such as a serial port, socket or pipe with minimal latency.
+// The descriptor is switched to non-blocking mode and polled; each chunk of
+// data is formatted as soon as it arrives, even if it only fills part of a
+// line, and the output is flushed immediately. If timestamps is true, each
+// chunk is preceded by the time elapsed since the dump started, taken from
+// the monotonic clock. A negative bytes_to_read dumps until end of input.
+void dump_live(FILE *out, int fd, uint64_t offset, int64_t bytes_to_read,
+               int line_length, bool timestamps);
+
+#endif
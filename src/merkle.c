@@ -0,0 +1,283 @@
+#include "merkle.h"
+#include "hash.h"
+#include "io.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Identifies a sidecar index file and its format version.
+#define MERKLE_MAGIC "DMPIDX01"
+
+// Number of consecutive blocks a hashing thread claims at a time. Claiming
+// small runs keeps the threads' reads close together in the file.
+#define MERKLE_BATCH 16
+
+typedef struct {
+  char magic[8];
+  uint32_t block_size;
+  uint32_t levels;
+  uint64_t file_size;
+  int64_t mtime;
+  uint64_t leaf_count;
+} MerkleHeader;
+
+typedef struct {
+  int fd;
+  uint32_t block_size;
+  uint64_t file_size;
+  uint64_t block_count;
+  uint64_t *leaves;
+  uint64_t next_block;
+} HashJob;
+
+static void *hash_worker(void *arg) {
+  HashJob *job = (HashJob *)arg;
+  uint8_t *buffer = malloc(job->block_size);
+  if (buffer == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  while (true) {
+    uint64_t first = __atomic_fetch_add(&job->next_block, MERKLE_BATCH,
+                                        __ATOMIC_RELAXED);
+    if (first >= job->block_count) {
+      break;
+    }
+    uint64_t last = first + MERKLE_BATCH;
+    last = last < job->block_count ? last : job->block_count;
+
+    for (uint64_t block = first; block < last; block++) {
+      uint64_t pos = block * job->block_size;
+      size_t want = job->file_size - pos < job->block_size
+                        ? job->file_size - pos
+                        : job->block_size;
+      size_t got = read_at(job->fd, buffer, want, pos);
+      job->leaves[block] = hash64(buffer, got, 0);
+    }
+  }
+
+  free(buffer);
+  return NULL;
+}
+
+// Sets up the level counts and pointers for a tree with the given number of
+// leaves and allocates its node storage.
+static MerkleTree *merkle_alloc(uint32_t block_size, uint64_t leaf_count) {
+  MerkleTree *tree = calloc(1, sizeof(MerkleTree));
+  if (tree == NULL) {
+    return NULL;
+  }
+  tree->block_size = block_size;
+
+  uint64_t total = 0;
+  uint64_t count = leaf_count;
+  tree->levels = 0;
+  do {
+    tree->counts[tree->levels++] = count;
+    total += count;
+    count = (count + 1) / 2;
+  } while (tree->counts[tree->levels - 1] > 1);
+
+  tree->nodes = malloc(sizeof(uint64_t) * (total > 0 ? total : 1));
+  if (tree->nodes == NULL) {
+    free(tree);
+    return NULL;
+  }
+
+  uint64_t *next = tree->nodes;
+  for (int i = 0; i < tree->levels; i++) {
+    tree->level[i] = next;
+    next += tree->counts[i];
+  }
+  return tree;
+}
+
+// Computes every level above the leaves. The level number seeds each hash so
+// that a node's hash never collides with one from another level.
+static void merkle_link(MerkleTree *tree) {
+  for (int l = 1; l < tree->levels; l++) {
+    uint64_t *children = tree->level[l - 1];
+    uint64_t child_count = tree->counts[l - 1];
+    for (uint64_t i = 0; i < tree->counts[l]; i++) {
+      size_t pair = 2 * i + 1 < child_count ? 2 : 1;
+      tree->level[l][i] =
+          hash64(&children[2 * i], sizeof(uint64_t) * pair, (uint64_t)l);
+    }
+  }
+}
+
+MerkleTree *merkle_build(int fd, uint32_t block_size, int threads) {
+  struct stat st;
+  uint64_t file_size;
+  if (fstat(fd, &st) != 0 || !input_size(fd, &file_size)) {
+    fprintf(stderr, "Error: Could not find the size of the input\n");
+    exit(1);
+  }
+
+  uint64_t block_count = (file_size + block_size - 1) / block_size;
+  MerkleTree *tree = merkle_alloc(block_size, block_count);
+  if (tree == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  tree->file_size = file_size;
+  tree->mtime = file_mtime(&st);
+
+  HashJob job = {fd, block_size, file_size, block_count, tree->level[0], 0};
+  if (threads < 1) {
+    threads = 1;
+  }
+  pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&workers[i], NULL, hash_worker, &job) != 0) {
+      fprintf(stderr, "Error: Could not start hashing thread\n");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+
+  merkle_link(tree);
+  return tree;
+}
+
+bool merkle_save(MerkleTree *tree, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    return false;
+  }
+
+  MerkleHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MERKLE_MAGIC, sizeof(header.magic));
+  header.block_size = tree->block_size;
+  header.levels = tree->levels;
+  header.file_size = tree->file_size;
+  header.mtime = tree->mtime;
+  header.leaf_count = tree->counts[0];
+
+  uint64_t total = 0;
+  for (int i = 0; i < tree->levels; i++) {
+    total += tree->counts[i];
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(tree->nodes, sizeof(uint64_t), total, file) == total;
+  return fclose(file) == 0 && ok;
+}
+
+MerkleTree *merkle_load(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+
+  MerkleHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, MERKLE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.block_size == 0) {
+    fclose(file);
+    return NULL;
+  }
+
+  MerkleTree *tree = merkle_alloc(header.block_size, header.leaf_count);
+  if (tree == NULL || tree->levels != (int)header.levels) {
+    merkle_free(tree);
+    fclose(file);
+    return NULL;
+  }
+  tree->file_size = header.file_size;
+  tree->mtime = header.mtime;
+
+  uint64_t total = 0;
+  for (int i = 0; i < tree->levels; i++) {
+    total += tree->counts[i];
+  }
+  if (fread(tree->nodes, sizeof(uint64_t), total, file) != total) {
+    merkle_free(tree);
+    tree = NULL;
+  }
+  fclose(file);
+  return tree;
+}
+
+bool merkle_is_current(MerkleTree *tree, int fd) {
+  // A device's modification time does not change when it is written to, so
+  // its trees are never trusted.
+  struct stat st;
+  return fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+         (uint64_t)st.st_size == tree->file_size &&
+         file_mtime(&st) == tree->mtime;
+}
+
+void merkle_free(MerkleTree *tree) {
+  if (tree != NULL) {
+    free(tree->nodes);
+    free(tree);
+  }
+}
+
+typedef struct {
+  MerkleTree *a;
+  MerkleTree *b;
+  uint64_t *blocks;
+  uint64_t count;
+  uint64_t capacity;
+} MerkleDiff;
+
+// Returns true if node i of level l covers at least one block of the tree.
+static bool covers(MerkleTree *tree, int l, uint64_t i) {
+  return tree->counts[0] > 0 && i <= (tree->counts[0] - 1) >> l;
+}
+
+static bool node_hash(MerkleTree *tree, int l, uint64_t i, uint64_t *hash) {
+  if (l >= tree->levels || i >= tree->counts[l]) {
+    return false;
+  }
+  *hash = tree->level[l][i];
+  return true;
+}
+
+static void diff_node(MerkleDiff *diff, int l, uint64_t i) {
+  if (!covers(diff->a, l, i) && !covers(diff->b, l, i)) {
+    return;
+  }
+
+  uint64_t hash_a, hash_b;
+  if (node_hash(diff->a, l, i, &hash_a) && node_hash(diff->b, l, i, &hash_b) &&
+      hash_a == hash_b) {
+    return;
+  }
+
+  if (l > 0) {
+    diff_node(diff, l - 1, 2 * i);
+    diff_node(diff, l - 1, 2 * i + 1);
+    return;
+  }
+
+  if (diff->count == diff->capacity) {
+    diff->capacity = diff->capacity < 64 ? 64 : diff->capacity * 2;
+    diff->blocks = realloc(diff->blocks, sizeof(uint64_t) * diff->capacity);
+    if (diff->blocks == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+  }
+  diff->blocks[diff->count++] = i;
+}
+
+uint64_t merkle_diff(MerkleTree *a, MerkleTree *b, uint64_t **blocks) {
+  MerkleDiff diff = {a, b, NULL, 0, 0};
+  int top = (a->levels > b->levels ? a->levels : b->levels) - 1;
+  diff_node(&diff, top, 0);
+  *blocks = diff.blocks;
+  return diff.count;
+}
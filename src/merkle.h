@@ -0,0 +1,48 @@
+#ifndef merkle_h
+#define merkle_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Maximum number of tree levels; enough for 2^63 leaves.
+#define MERKLE_MAX_LEVELS 64
+
+// A binary hash tree over the fixed-size blocks of a file. Node i of level L
+// covers blocks [i * 2^L, (i + 1) * 2^L), so trees built with the same block
+// size can be compared top-down even when the files differ in length.
+typedef struct {
+  uint32_t block_size;
+  uint64_t file_size;
+  int64_t mtime;
+  int levels;
+  uint64_t counts[MERKLE_MAX_LEVELS]; // Number of nodes on each level.
+  uint64_t *level[MERKLE_MAX_LEVELS]; // Pointers into nodes, leaves first.
+  uint64_t *nodes;
+} MerkleTree;
+
+// Hashes every block of the file or block device in parallel on `threads`
+// threads and builds the tree. Exits with an error message if the input
+// cannot be read or its size cannot be found.
+MerkleTree *merkle_build(int fd, uint32_t block_size, int threads);
+
+// Writes the tree to a sidecar file. Returns false on failure.
+bool merkle_save(MerkleTree *tree, const char *path);
+
+// Reads a tree from a sidecar file. Returns NULL if the file is missing or
+// is not a valid index.
+MerkleTree *merkle_load(const char *path);
+
+// Returns true if the tree still describes the file, judging by its size and
+// modification time. Always false for anything but a regular file.
+bool merkle_is_current(MerkleTree *tree, int fd);
+
+// Free the memory associated with a tree.
+void merkle_free(MerkleTree *tree);
+
+// Finds the blocks whose contents differ between two trees built with the
+// same block size, descending only into subtrees whose hashes differ. Returns
+// the number of differing blocks and stores their indices, in ascending
+// order, in a freshly-allocated array in *blocks.
+uint64_t merkle_diff(MerkleTree *a, MerkleTree *b, uint64_t **blocks);
+
+#endif
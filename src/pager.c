@@ -0,0 +1,486 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "pager.h"
+#include "dump.h"
+#include "format.h"
+#include "io.h"
+#include "terminal.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Longest search pattern or offset that can be typed at a prompt.
+#define PAGER_PROMPT_SIZE 256
+
+// Bytes read at a time while searching.
+#define PAGER_SEARCH_CHUNK (1 << 20)
+
+// Key codes returned for escape sequences, outside the range of bytes.
+enum {
+  KEY_UP = 256,
+  KEY_DOWN,
+  KEY_PAGE_UP,
+  KEY_PAGE_DOWN,
+  KEY_HOME,
+  KEY_END,
+  KEY_RESIZE,
+};
+
+typedef struct {
+  const char *name;
+  int fd;
+  uint64_t size;
+  uint8_t *view; // The lines on screen, read afresh for every render.
+  size_t view_capacity;
+  int line_length;
+  bool auto_line; // Fit the line length to the terminal width.
+  uint64_t top; // Offset of the first line on screen.
+  int rows;
+  int columns;
+  int tty;
+  char message[PAGER_PROMPT_SIZE + 64];
+
+  uint8_t pattern[PAGER_PROMPT_SIZE];
+  size_t pattern_length;
+  uint64_t match;
+  bool matched;
+} Pager;
+
+static volatile sig_atomic_t resized = 0;
+
+// Terminal settings to restore on any exit, once raw mode is on.
+static struct termios saved_termios;
+static int saved_tty = -1;
+
+static void restore_terminal(void) {
+  if (saved_tty < 0) {
+    return;
+  }
+  write_all(STDOUT_FILENO, "\033[?25h\033[?1049l", 14);
+  tcsetattr(saved_tty, TCSAFLUSH, &saved_termios);
+  saved_tty = -1;
+}
+
+// Leaves the alternate screen before reporting, so the error stays visible.
+static void out_of_memory(void) {
+  restore_terminal();
+  fprintf(stderr, "Error: Insufficient Memory \n");
+  exit(1);
+}
+
+static void on_resize(int signal) {
+  (void)signal;
+  resized = 1;
+}
+
+static void update_size(Pager *pager) {
+  struct winsize size;
+  pager->rows = 24;
+  pager->columns = 80;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 1 &&
+      size.ws_col > 0) {
+    pager->rows = size.ws_row;
+    pager->columns = size.ws_col;
+  }
+  if (pager->auto_line) {
+    pager->line_length = fit_dump_line_length(pager->columns);
+  }
+}
+
+// Number of lines of data that fit above the status line.
+static uint64_t page_lines(Pager *pager) { return pager->rows - 1; }
+
+// Moves the view so that its first line holds pos, without scrolling past
+// the point where the last line of the file is at the bottom of the screen.
+static void scroll_to(Pager *pager, uint64_t pos) {
+  uint64_t lines = (pager->size + pager->line_length - 1) / pager->line_length;
+  uint64_t last = lines > page_lines(pager)
+                      ? (lines - page_lines(pager)) * pager->line_length
+                      : 0;
+  pos -= pos % pager->line_length;
+  pager->top = pos < last ? pos : last;
+}
+
+static void scroll_by(Pager *pager, int64_t lines) {
+  int64_t delta = lines * pager->line_length;
+  if (delta < 0 && (uint64_t)-delta > pager->top) {
+    scroll_to(pager, 0);
+  } else {
+    scroll_to(pager, pager->top + delta);
+  }
+}
+
+// Reads the lines on screen into the view and returns their number of bytes.
+// If the file has shrunk, the view is moved back within its new size first.
+static size_t read_view(Pager *pager) {
+  for (bool retried = false;; retried = true) {
+    uint64_t shown = pager->top < pager->size ? pager->size - pager->top : 0;
+    if (shown > page_lines(pager) * pager->line_length) {
+      shown = page_lines(pager) * pager->line_length;
+    }
+    if (shown > pager->view_capacity) {
+      free(pager->view);
+      pager->view = malloc(shown);
+      pager->view_capacity = shown;
+      if (pager->view == NULL) {
+        out_of_memory();
+      }
+    }
+
+    size_t num_bytes = 0;
+    if (shown > 0 &&
+        !try_read_at(pager->fd, pager->view, shown, pager->top, &num_bytes)) {
+      snprintf(pager->message, sizeof(pager->message), "Could not read file");
+      return num_bytes;
+    }
+    uint64_t size;
+    if (num_bytes == shown || retried || !input_size(pager->fd, &size) ||
+        size >= pager->size) {
+      return num_bytes;
+    }
+    snprintf(pager->message, sizeof(pager->message), "File was truncated");
+    pager->size = size;
+    scroll_to(pager, pager->top);
+  }
+}
+
+// Formats the visible lines and the status line and writes them to the
+// terminal in one go.
+static void render(Pager *pager) {
+  char *screen;
+  size_t screen_length;
+  FILE *out = open_memstream(&screen, &screen_length);
+  if (out == NULL) {
+    out_of_memory();
+  }
+
+  // Clear the screen and draw the page in one go, marking the rows past the
+  // end of the file.
+  fputs("\033[H\033[J", out);
+  uint64_t rows = page_lines(pager);
+  size_t shown = read_view(pager);
+  print_lines(out, pager->view, shown, pager->top, pager->line_length);
+  for (uint64_t row = (shown + pager->line_length - 1) / pager->line_length;
+       row < rows; row++) {
+    fputs("~\n", out);
+  }
+
+  unsigned long long end = pager->top + page_lines(pager) * pager->line_length;
+  end = end < pager->size ? end : pager->size;
+  // The status line is cut to the terminal width so that it never wraps.
+  char status[PAGER_PROMPT_SIZE * 2];
+  snprintf(status, sizeof(status), " %s  %08llx-%08llx of %08llx  %s",
+           pager->name, (unsigned long long)pager->top, end,
+           (unsigned long long)pager->size, pager->message);
+  fprintf(out, "\033[2K\033[7m%.*s\033[0m", pager->columns, status);
+  fclose(out);
+
+  write_all(STDOUT_FILENO, screen, screen_length);
+  free(screen);
+  pager->message[0] = '\0';
+}
+
+// Reads one key press, decoding the escape sequences of the arrow and paging
+// keys. Returns KEY_RESIZE if the terminal was resized meanwhile.
+static int read_key(Pager *pager) {
+  uint8_t c;
+  while (true) {
+    if (resized) {
+      resized = 0;
+      return KEY_RESIZE;
+    }
+    ssize_t n = read(pager->tty, &c, 1);
+    if (n == 1) {
+      break;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    return 'q';
+  }
+  if (c != '\033') {
+    return c;
+  }
+
+  // A lone escape is followed by nothing, so only wait briefly for more.
+  uint8_t sequence[3];
+  struct pollfd pfd = {pager->tty, POLLIN, 0};
+  int length = 0;
+  while (length < 3 && poll(&pfd, 1, 50) == 1 &&
+         read(pager->tty, &sequence[length], 1) == 1) {
+    length++;
+    if (length >= 2 && (isalpha(sequence[length - 1]) ||
+                        sequence[length - 1] == '~')) {
+      break;
+    }
+  }
+  if (length < 2 || sequence[0] != '[') {
+    return '\033';
+  }
+  switch (sequence[1]) {
+  case 'A':
+    return KEY_UP;
+  case 'B':
+    return KEY_DOWN;
+  case 'H':
+    return KEY_HOME;
+  case 'F':
+    return KEY_END;
+  case '5':
+    return KEY_PAGE_UP;
+  case '6':
+    return KEY_PAGE_DOWN;
+  }
+  return '\033';
+}
+
+// Reads a line of input on the status line. Returns false if it was
+// cancelled with escape.
+static bool prompt(Pager *pager, const char *label, char *input) {
+  size_t length = 0;
+  input[0] = '\0';
+  while (true) {
+    char line[PAGER_PROMPT_SIZE + 32];
+    int line_length = snprintf(line, sizeof(line), "\033[%d;1H\033[2K%s%s",
+                               pager->rows, label, input);
+    write_all(STDOUT_FILENO, line, line_length);
+
+    int key = read_key(pager);
+    if (key == '\r' || key == '\n') {
+      return true;
+    }
+    if (key == '\033' || key == 3) {
+      return false;
+    }
+    if ((key == 127 || key == '\b') && length > 0) {
+      input[--length] = '\0';
+    } else if (key >= 32 && key < 127 && length + 1 < PAGER_PROMPT_SIZE) {
+      input[length++] = key;
+      input[length] = '\0';
+    }
+  }
+}
+
+// Finds the first occurrence of the pattern at or after start, reading the
+// file in chunks that overlap so that matches across their ends are found.
+static bool find_forward(Pager *pager, uint8_t *chunk, uint64_t start,
+                         uint64_t *match) {
+  size_t length = pager->pattern_length;
+  size_t want = PAGER_SEARCH_CHUNK + length - 1;
+  for (uint64_t pos = start; pos < pager->size; pos += PAGER_SEARCH_CHUNK) {
+    size_t num_bytes;
+    if (!try_read_at(pager->fd, chunk, want, pos, &num_bytes)) {
+      return false;
+    }
+    uint8_t *found = memmem(chunk, num_bytes, pager->pattern, length);
+    if (found != NULL) {
+      *match = pos + (found - chunk);
+      return true;
+    }
+    if (num_bytes < want) {
+      break;
+    }
+  }
+  return false;
+}
+
+// Finds the last occurrence of the pattern that starts before end.
+static bool find_backward(Pager *pager, uint8_t *chunk, uint64_t end,
+                          uint64_t *match) {
+  size_t length = pager->pattern_length;
+  while (end > 0) {
+    uint64_t begin = end > PAGER_SEARCH_CHUNK ? end - PAGER_SEARCH_CHUNK : 0;
+    size_t num_bytes;
+    if (!try_read_at(pager->fd, chunk, end - begin + length - 1, begin,
+                     &num_bytes)) {
+      return false;
+    }
+    for (size_t pos = end - begin; pos-- > 0;) {
+      if (pos + length <= num_bytes && chunk[pos] == pager->pattern[0] &&
+          memcmp(chunk + pos, pager->pattern, length) == 0) {
+        *match = begin + pos;
+        return true;
+      }
+    }
+    end = begin;
+  }
+  return false;
+}
+
+// Finds the next (or previous) occurrence of the pattern after (or before)
+// the last match, or the top of the screen if there is none.
+static void search(Pager *pager, bool forward) {
+  uint64_t from = pager->matched ? pager->match : pager->top;
+  size_t length = pager->pattern_length;
+  if (length == 0) {
+    snprintf(pager->message, sizeof(pager->message), "No pattern");
+    return;
+  }
+
+  uint8_t *chunk = malloc(PAGER_SEARCH_CHUNK + PAGER_PROMPT_SIZE);
+  if (chunk == NULL) {
+    out_of_memory();
+  }
+  uint64_t match;
+  bool found = false;
+  if (forward) {
+    found = find_forward(pager, chunk, pager->matched ? from + 1 : from,
+                         &match);
+  } else if (pager->size >= length) {
+    uint64_t end = from < pager->size - length ? from : pager->size - length;
+    found = find_backward(pager, chunk, end, &match);
+  }
+  free(chunk);
+
+  if (!found) {
+    snprintf(pager->message, sizeof(pager->message), "Pattern not found");
+    return;
+  }
+  pager->match = match;
+  pager->matched = true;
+  scroll_to(pager, pager->match);
+  snprintf(pager->message, sizeof(pager->message), "Match at %08llx",
+           (unsigned long long)pager->match);
+}
+
+static void jump(Pager *pager, const char *input) {
+  int64_t pos;
+  if (!try_parse_size(input, &pos)) {
+    snprintf(pager->message, sizeof(pager->message),
+             "Cannot parse '%s' as an offset", input);
+    return;
+  }
+  if (pos < 0) {
+    pos = (uint64_t)-pos < pager->size ? (int64_t)pager->size + pos : 0;
+  }
+  scroll_to(pager, pos);
+}
+
+void run_pager(int fd, const char *name, uint64_t offset, int line_length) {
+  Pager pager;
+  memset(&pager, 0, sizeof(pager));
+  pager.name = name;
+  pager.fd = fd;
+  pager.line_length = line_length;
+  pager.auto_line = line_length == 0;
+
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size < 0) {
+    fprintf(stderr, "Error: The pager requires a seekable file\n");
+    exit(1);
+  }
+  pager.size = size;
+
+  pager.tty = open("/dev/tty", O_RDONLY);
+  struct termios saved;
+  if (pager.tty < 0 || !isatty(STDOUT_FILENO) ||
+      tcgetattr(pager.tty, &saved) != 0) {
+    fprintf(stderr, "Error: The pager requires a terminal\n");
+    exit(1);
+  }
+  struct termios raw = saved;
+  raw.c_iflag &= ~(ICRNL | IXON);
+  raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+  raw.c_cc[VMIN] = 1;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(pager.tty, TCSAFLUSH, &raw);
+  saved_termios = saved;
+  saved_tty = pager.tty;
+  atexit(restore_terminal);
+
+  // No SA_RESTART, so that a resize interrupts the wait for a key.
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_resize;
+  sigaction(SIGWINCH, &action, NULL);
+
+  // Use the alternate screen and hide the cursor.
+  write_all(STDOUT_FILENO, "\033[?1049h\033[?25l\033[2J", 18);
+  update_size(&pager);
+  scroll_to(&pager, offset);
+
+  char input[PAGER_PROMPT_SIZE];
+  bool running = true;
+  while (running) {
+    render(&pager);
+    int key = read_key(&pager);
+    switch (key) {
+    case 'q':
+    case 3:
+      running = false;
+      break;
+    case 'j':
+    case '\r':
+    case KEY_DOWN:
+      scroll_by(&pager, 1);
+      break;
+    case 'k':
+    case KEY_UP:
+      scroll_by(&pager, -1);
+      break;
+    case ' ':
+    case 'f':
+    case KEY_PAGE_DOWN:
+      scroll_by(&pager, page_lines(&pager));
+      break;
+    case 'b':
+    case KEY_PAGE_UP:
+      scroll_by(&pager, -(int64_t)page_lines(&pager));
+      break;
+    case 'g':
+    case KEY_HOME:
+      scroll_to(&pager, 0);
+      break;
+    case 'G':
+    case KEY_END:
+      scroll_to(&pager, pager.size);
+      break;
+    case ':':
+    case 'o':
+      if (prompt(&pager, "Offset: ", input)) {
+        jump(&pager, input);
+      }
+      break;
+    case '/':
+    case '?':
+      if (prompt(&pager, key == '/' ? "/" : "?", input)) {
+        pager.matched = false;
+        if (try_parse_pattern(input, pager.pattern, sizeof(pager.pattern),
+                              &pager.pattern_length)) {
+          search(&pager, key == '/');
+        } else {
+          pager.pattern_length = 0;
+          snprintf(pager.message, sizeof(pager.message), "Invalid pattern");
+        }
+      }
+      break;
+    case 'n':
+      search(&pager, true);
+      break;
+    case 'N':
+      search(&pager, false);
+      break;
+    case KEY_RESIZE:
+      update_size(&pager);
+      write_all(STDOUT_FILENO, "\033[2J", 4);
+      scroll_to(&pager, pager.top);
+      break;
+    }
+  }
+
+  restore_terminal();
+  close(pager.tty);
+  free(pager.view);
+}
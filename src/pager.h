@@ -0,0 +1,15 @@
+#ifndef pager_h
+#define pager_h
+
+#include <stdint.h>
+
+// Shows the file interactively on the terminal, starting at the line that
+// holds `offset`. The file is memory-mapped and only the lines on screen are
+// ever formatted, as the offset of line N is simply N * line_length, so
+// moving anywhere in a file of any size is instant. Supports scrolling,
+// jumping to an offset and searching for text or hex bytes. A line_length
+// of 0 fits the lines to the terminal width, following resizes. Exits with
+// an error message if the file cannot be mapped or there is no terminal.
+void run_pager(int fd, const char *name, uint64_t offset, int line_length);
+
+#endif
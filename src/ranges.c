@@ -0,0 +1,213 @@
+#include "ranges.h"
+#include "dump.h"
+#include "io.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Regions separated by at most this many bytes are read together, as one
+// larger read is cheaper than two nearby small ones.
+#define RANGE_COALESCE_GAP (64 << 10)
+
+// Largest read that regions are coalesced into.
+#define RANGE_MAX_EXTENT (8 << 20)
+
+// Requested bytes buffered at once. Regions are processed in batches of
+// about this size, and any region larger than this is streamed on its own.
+#define RANGE_BATCH_BYTES (64 << 20)
+
+// Bytes read per step when streaming a large region.
+#define RANGE_CHUNK_SIZE (1 << 20)
+
+// A single read covering one or more coalesced regions.
+typedef struct {
+  uint64_t start;
+  uint64_t length;
+  size_t num_bytes;
+  uint8_t *data;
+} Extent;
+
+typedef struct {
+  int fd;
+  Extent *extents;
+  int count;
+  int next;
+} ReadJob;
+
+static void *read_worker(void *arg) {
+  ReadJob *job = (ReadJob *)arg;
+  while (true) {
+    int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+    if (i >= job->count) {
+      break;
+    }
+    Extent *extent = &job->extents[i];
+    extent->num_bytes =
+        read_at(job->fd, extent->data, extent->length, extent->start);
+  }
+  return NULL;
+}
+
+static void read_extents(int fd, Extent *extents, int count, int threads) {
+  ReadJob job = {fd, extents, count, 0};
+  threads = threads < count ? threads : count;
+  if (threads <= 1) {
+    read_worker(&job);
+    return;
+  }
+
+  pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&workers[i], NULL, read_worker, &job) != 0) {
+      fprintf(stderr, "Error: Could not start reader thread\n");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+}
+
+static void print_separator(FILE *out, bool *first, bool separate) {
+  if (separate && !*first) {
+    fputc('\n', out);
+  }
+  *first = false;
+}
+
+// Dumps a region too large to buffer by reading it in chunks. The chunk size
+// is a whole number of lines so that line offsets are unaffected.
+static void stream_range(FILE *out, int fd, Range *range, int line_length) {
+  size_t chunk_size = RANGE_CHUNK_SIZE - RANGE_CHUNK_SIZE % line_length;
+  chunk_size = chunk_size > 0 ? chunk_size : (size_t)line_length;
+  uint8_t *buffer = malloc(chunk_size);
+  if (buffer == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  uint64_t pos = range->start;
+  uint64_t end = range->start + range->length;
+  while (pos < end) {
+    size_t want = end - pos < chunk_size ? end - pos : chunk_size;
+    size_t num_bytes = read_at(fd, buffer, want, pos);
+    print_lines(out, buffer, num_bytes, pos, line_length);
+    if (num_bytes < want) {
+      break;
+    }
+    pos += num_bytes;
+  }
+  free(buffer);
+}
+
+// A region's start offset paired with its position in the request.
+typedef struct {
+  uint64_t start;
+  int index;
+} SortKey;
+
+static int compare_keys(const void *a, const void *b) {
+  const SortKey *key_a = (const SortKey *)a;
+  const SortKey *key_b = (const SortKey *)b;
+  if (key_a->start != key_b->start) {
+    return key_a->start > key_b->start ? 1 : -1;
+  }
+  return key_a->index - key_b->index;
+}
+
+// Reads and dumps a batch of regions that fits in memory.
+static void dump_batch(FILE *out, int fd, Range *ranges, int count,
+                       int line_length, int threads, bool *first,
+                       bool separate) {
+  SortKey *order = malloc(sizeof(SortKey) * count);
+  int *owner = malloc(sizeof(int) * count);
+  Extent *extents = malloc(sizeof(Extent) * count);
+  if (order == NULL || owner == NULL || extents == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  for (int i = 0; i < count; i++) {
+    order[i] = (SortKey){ranges[i].start, i};
+  }
+  qsort(order, count, sizeof(SortKey), compare_keys);
+
+  // Merge each region into the previous extent if it is close enough.
+  int extent_count = 0;
+  for (int k = 0; k < count; k++) {
+    Range *range = &ranges[order[k].index];
+    uint64_t end = range->start + range->length;
+    if (extent_count > 0) {
+      Extent *last = &extents[extent_count - 1];
+      uint64_t last_end = last->start + last->length;
+      uint64_t merged_end = end > last_end ? end : last_end;
+      if (range->start <= last_end + RANGE_COALESCE_GAP &&
+          merged_end - last->start <= RANGE_MAX_EXTENT) {
+        last->length = merged_end - last->start;
+        owner[order[k].index] = extent_count - 1;
+        continue;
+      }
+    }
+    extents[extent_count++] = (Extent){range->start, range->length, 0, NULL};
+    owner[order[k].index] = extent_count - 1;
+  }
+
+  for (int i = 0; i < extent_count; i++) {
+    extents[i].data = malloc(extents[i].length > 0 ? extents[i].length : 1);
+    if (extents[i].data == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+  }
+  read_extents(fd, extents, extent_count, threads);
+
+  for (int i = 0; i < count; i++) {
+    Extent *extent = &extents[owner[i]];
+    uint64_t skip = ranges[i].start - extent->start;
+    size_t num_bytes = 0;
+    if (skip < extent->num_bytes) {
+      num_bytes = extent->num_bytes - skip;
+      num_bytes = num_bytes < ranges[i].length ? num_bytes : ranges[i].length;
+    }
+    print_separator(out, first, separate);
+    print_lines(out, extent->data + skip, num_bytes, ranges[i].start,
+                line_length);
+  }
+
+  for (int i = 0; i < extent_count; i++) {
+    free(extents[i].data);
+  }
+  free(extents);
+  free(owner);
+  free(order);
+}
+
+void dump_ranges(FILE *out, int fd, Range *ranges, int count,
+                 int line_length, int threads, bool separate) {
+  bool first = true;
+  int batch_start = 0;
+  uint64_t batch_bytes = 0;
+
+  for (int i = 0; i <= count; i++) {
+    bool large = i < count && ranges[i].length > RANGE_BATCH_BYTES;
+    if (i == count || large ||
+        batch_bytes + ranges[i].length > RANGE_BATCH_BYTES) {
+      if (i > batch_start) {
+        dump_batch(out, fd, ranges + batch_start, i - batch_start,
+                   line_length, threads, &first, separate);
+      }
+      batch_start = i;
+      batch_bytes = 0;
+    }
+    if (large) {
+      print_separator(out, &first, separate);
+      stream_range(out, fd, &ranges[i], line_length);
+      batch_start = i + 1;
+    } else if (i < count) {
+      batch_bytes += ranges[i].length;
+    }
+  }
+}
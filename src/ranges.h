@@ -0,0 +1,22 @@
+#ifndef ranges_h
+#define ranges_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A region of the input to dump.
+typedef struct {
+  uint64_t start;
+  uint64_t length;
+} Range;
+
+// Dumps many regions of a seekable file in one pass, in the order given.
+// Requested regions are sorted and nearby ones are coalesced into larger
+// reads, which are issued in parallel on up to `threads` threads. Regions end
+// early at the end of the file. If separate is true, each region after the
+// first is preceded by a blank line.
+void dump_ranges(FILE *out, int fd, Range *ranges, int count,
+                 int line_length, int threads, bool separate);
+
+#endif
@@ -0,0 +1,301 @@
+#include "record.h"
+#include "format.h"
+#include "io.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes of input read and formatted at a time. Whole records are read in one
+// go, so a table of millions of small records takes few reads and writes.
+#define RECORD_CHUNK_SIZE (256 << 10)
+
+// Longest char[N] or bytes[N] field.
+#define RECORD_MAX_ARRAY 4096
+
+typedef enum {
+  FIELD_NUMBER, // An integer or float, converted by put_value.
+  FIELD_CHARS,  // Text, with non-printable bytes shown as '.'.
+  FIELD_BYTES,  // Raw bytes in hex.
+} FieldKind;
+
+typedef struct {
+  char *name;
+  uint64_t offset;
+  int size;
+  FieldKind kind;
+  Radix radix;
+  bool big_endian;
+  int width; // Width of the field's column.
+} Field;
+
+struct RecordLayout {
+  Field *fields;
+  int count;
+  uint64_t size;
+  size_t row_size; // Upper bound on the length of a formatted row.
+};
+
+static void layout_error(const char *path, long line_number,
+                         const char *reason) {
+  fprintf(stderr, "Error: %s on line %ld of '%s'\n", reason, line_number,
+          path);
+  exit(1);
+}
+
+// Parses a type name into the field. Returns false if it is not a type.
+static bool parse_type(const char *type, Field *field) {
+  if (try_parse_type(type, &field->size, &field->radix)) {
+    field->kind = FIELD_NUMBER;
+    return true;
+  }
+
+  int length;
+  char close;
+  if (sscanf(type, "char[%d%c", &length, &close) == 2) {
+    field->kind = FIELD_CHARS;
+  } else if (sscanf(type, "bytes[%d%c", &length, &close) == 2) {
+    field->kind = FIELD_BYTES;
+  } else {
+    return false;
+  }
+  if (close != ']' || type[strlen(type) - 1] != ']' || length <= 0 ||
+      length > RECORD_MAX_ARRAY) {
+    return false;
+  }
+  field->size = length;
+  return true;
+}
+
+RecordLayout *record_load(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Could not open file '%s'\n", path);
+    exit(1);
+  }
+
+  RecordLayout *layout = calloc(1, sizeof(RecordLayout));
+  if (layout == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  int capacity = 0;
+  uint64_t next = 0;
+  int64_t size = -1;
+  bool big_endian = false;
+
+  char *line = NULL;
+  size_t line_capacity = 0;
+  long line_number = 0;
+  while (getline(&line, &line_capacity, file) >= 0) {
+    line_number++;
+    char *words[4];
+    int count = 0;
+    char *save;
+    for (char *word = strtok_r(line, " \t\r\n", &save); word != NULL;
+         word = strtok_r(NULL, " \t\r\n", &save)) {
+      if (count == 0 && word[0] == '#') {
+        break;
+      }
+      if (count == 4) {
+        layout_error(path, line_number, "Too many words");
+      }
+      words[count++] = word;
+    }
+    if (count == 0) {
+      continue;
+    }
+
+    if (strcmp(words[0], "size") == 0 && count == 2) {
+      if (!try_parse_size(words[1], &size) || size <= 0) {
+        layout_error(path, line_number, "Invalid record size");
+      }
+      continue;
+    }
+    if (strcmp(words[0], "endian") == 0 && count == 2) {
+      if (strcmp(words[1], "big") != 0 && strcmp(words[1], "little") != 0) {
+        layout_error(path, line_number, "Invalid byte order");
+      }
+      big_endian = strcmp(words[1], "big") == 0;
+      continue;
+    }
+
+    Field field = {NULL, next, 0, FIELD_NUMBER, RADIX_DECIMAL, big_endian, 0};
+    if (count < 2 || !parse_type(words[1], &field)) {
+      layout_error(path, line_number, "Invalid field");
+    }
+    for (int i = 2; i < count; i++) {
+      int64_t offset;
+      if (words[i][0] == '@' && try_parse_size(words[i] + 1, &offset) &&
+          offset >= 0) {
+        field.offset = offset;
+      } else if (strcmp(words[i], "big") == 0 ||
+                 strcmp(words[i], "little") == 0) {
+        field.big_endian = strcmp(words[i], "big") == 0;
+      } else {
+        layout_error(path, line_number, "Invalid field");
+      }
+    }
+    next = field.offset + field.size;
+
+    field.width = field.kind == FIELD_NUMBER
+                      ? unit_width(field.radix, field.size)
+                      : field.size * (field.kind == FIELD_BYTES ? 2 : 1);
+    if ((int)strlen(words[0]) > field.width) {
+      field.width = strlen(words[0]);
+    }
+    field.name = strdup(words[0]);
+
+    if (layout->count == capacity) {
+      capacity = capacity > 0 ? 2 * capacity : 16;
+      layout->fields = realloc(layout->fields, sizeof(Field) * capacity);
+    }
+    if (field.name == NULL || layout->fields == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+    layout->fields[layout->count++] = field;
+    layout->row_size += 2 + field.width;
+    if (field.kind == FIELD_CHARS) {
+      layout->row_size += (GLYPH_MAX - 1) * field.size;
+    }
+    if (next > layout->size) {
+      layout->size = next;
+    }
+  }
+  free(line);
+  fclose(file);
+
+  if (layout->count == 0) {
+    fprintf(stderr, "Error: No fields in record layout '%s'\n", path);
+    exit(1);
+  }
+  if (size >= 0) {
+    if ((uint64_t)size < layout->size) {
+      fprintf(stderr, "Error: Fields extend past the record size in '%s'\n",
+              path);
+      exit(1);
+    }
+    layout->size = size;
+  }
+  // The offset column and the newline.
+  layout->row_size += 32;
+  return layout;
+}
+
+// Formats one record of which only the first `available` bytes exist.
+static char *put_record(char *p, RecordLayout *layout, const uint8_t *record,
+                        uint64_t available, uint64_t offset) {
+  // The offset ends with one of the two spaces before the first field.
+  p = put_offset(p, offset);
+  for (int i = 0; i < layout->count; i++) {
+    Field *field = &layout->fields[i];
+    const uint8_t *bytes = record + field->offset;
+    if (i > 0) {
+      *p++ = ' ';
+    }
+    *p++ = ' ';
+    int pad = field->width;
+    char *start = p;
+    if (field->offset + field->size <= available) {
+      switch (field->kind) {
+      case FIELD_NUMBER:
+        // Numbers are right-aligned.
+        memset(p, ' ', field->width - unit_width(field->radix, field->size));
+        p += field->width - unit_width(field->radix, field->size);
+        p = put_value(p, bytes, field->size, field->radix, field->big_endian);
+        break;
+      case FIELD_CHARS:
+        for (int j = 0; j < field->size; j++) {
+          p = put_char(p, bytes[j]);
+        }
+        break;
+      case FIELD_BYTES:
+        for (int j = 0; j < field->size; j++) {
+          p = put_value(p, bytes + j, 1, RADIX_HEX, false);
+        }
+        break;
+      }
+      // Characters may take several bytes but one column each.
+      pad = field->width -
+            (field->kind == FIELD_CHARS ? field->size : (int)(p - start));
+    }
+    memset(p, ' ', pad);
+    p += pad;
+  }
+  *p++ = '\n';
+  return p;
+}
+
+// Prints the names of the fields, aligned with their columns.
+static void print_header(FILE *out, RecordLayout *layout) {
+  fprintf(out, "%-8s", "offset");
+  for (int i = 0; i < layout->count; i++) {
+    Field *field = &layout->fields[i];
+    if (field->kind == FIELD_NUMBER) {
+      fprintf(out, "  %*s", field->width, field->name);
+    } else {
+      fprintf(out, "  %-*s", field->width, field->name);
+    }
+  }
+  fputc('\n', out);
+}
+
+void dump_records(FILE *out, FILE *file, uint64_t offset,
+                  int64_t bytes_to_read, RecordLayout *layout) {
+  uint64_t per_chunk = RECORD_CHUNK_SIZE / layout->size;
+  per_chunk = per_chunk > 0 ? per_chunk : 1;
+  size_t chunk_size = per_chunk * layout->size;
+  uint8_t *buffer = malloc(chunk_size);
+  char *text = malloc(per_chunk * layout->row_size);
+  if (buffer == NULL || text == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  print_header(out, layout);
+  while (bytes_to_read != 0) {
+    size_t wanted = chunk_size;
+    if (bytes_to_read > 0 && (uint64_t)bytes_to_read < wanted) {
+      wanted = bytes_to_read;
+    }
+    // Fill the whole chunk, so that only the last record can be partial.
+    size_t length = 0;
+    while (length < wanted) {
+      size_t got = fread(buffer + length, 1, wanted - length, file);
+      if (got == 0) {
+        break;
+      }
+      length += got;
+    }
+    if (length == 0) {
+      break;
+    }
+
+    char *p = text;
+    for (size_t pos = 0; pos < length; pos += layout->size) {
+      p = put_record(p, layout, buffer + pos, length - pos, offset + pos);
+    }
+    fwrite(text, 1, p - text, out);
+    offset += length;
+    if (bytes_to_read > 0) {
+      bytes_to_read -= length;
+    }
+    if (length < wanted) {
+      break;
+    }
+  }
+  free(buffer);
+  free(text);
+}
+
+void record_free(RecordLayout *layout) {
+  if (layout != NULL) {
+    for (int i = 0; i < layout->count; i++) {
+      free(layout->fields[i].name);
+    }
+    free(layout->fields);
+    free(layout);
+  }
+}
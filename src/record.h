@@ -0,0 +1,32 @@
+#ifndef record_h
+#define record_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// A fixed-size record layout compiled into a list of field extractors.
+typedef struct RecordLayout RecordLayout;
+
+// Loads a record layout from a file with one field per line:
+//
+//   <name> <type> [@<offset>] [little|big]
+//
+// where the type is one of u8, i8, u16, i16, u32, i32, u64, i64, f32, f64,
+// char[N] (text) or bytes[N] (hex). A field without an offset follows the
+// previous one. The lines `size <bytes>` and `endian little|big` set the
+// record size, which defaults to the end of the last field, and the default
+// byte order. Blank lines and lines starting with # are ignored. Exits with
+// an error message if the file cannot be read or is malformed.
+RecordLayout *record_load(const char *path);
+
+// Prints the records from `offset` onwards as a table with a header row and
+// one row per record, stopping after bytes_to_read bytes if it is not
+// negative. A record cut short by the end of the input shows only its
+// complete fields.
+void dump_records(FILE *out, FILE *file, uint64_t offset,
+                  int64_t bytes_to_read, RecordLayout *layout);
+
+// Free the memory associated with a record layout.
+void record_free(RecordLayout *layout);
+
+#endif
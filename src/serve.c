@@ -0,0 +1,192 @@
+#include "serve.h"
+#include "batch.h"
+#include "dump.h"
+#include "io.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Input bytes formatted per response frame, so that large requests are
+// streamed back without formatting them in one piece.
+#define SERVE_FRAME_BYTES (256 << 10)
+
+typedef struct {
+  FileCache *cache;
+  int line_length;
+  int fd;
+  // Input bytes of the frame being formatted, reused from request to request.
+  uint8_t *buffer;
+  size_t buffer_size;
+} Connection;
+
+static bool send_frame(int fd, const char *data, size_t length) {
+  char header[32];
+  int header_length = snprintf(header, sizeof(header), "%zu\n", length);
+  return write_all(fd, header, header_length) && write_all(fd, data, length);
+}
+
+// Streams the formatted bytes of the requested range back in frames, reading
+// each frame into the connection's buffer. If the file is cut short or
+// cannot be read, the response ends with an error line instead of the empty
+// frame. Returns false if the client has gone away.
+static bool send_range(Connection *conn, OpenFile *file, uint64_t offset,
+                       int64_t length, int line_length) {
+  uint64_t start = offset < file->size ? offset : file->size;
+  uint64_t end = file->size;
+  if (length >= 0 && (uint64_t)length < end - start) {
+    end = start + length;
+  }
+
+  size_t frame_bytes = SERVE_FRAME_BYTES - SERVE_FRAME_BYTES % line_length;
+  frame_bytes = frame_bytes > 0 ? frame_bytes : (size_t)line_length;
+  if (conn->buffer_size < frame_bytes) {
+    free(conn->buffer);
+    conn->buffer = malloc(frame_bytes);
+    if (conn->buffer == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+    conn->buffer_size = frame_bytes;
+  }
+
+  for (uint64_t pos = start; pos < end; pos += frame_bytes) {
+    size_t want = end - pos < frame_bytes ? end - pos : frame_bytes;
+    size_t num_bytes;
+    bool read = try_read_at(file->fd, conn->buffer, want, pos, &num_bytes);
+    if (!read || num_bytes < want) {
+      const char *message = read ? "!Could not read file: File was truncated\n"
+                                 : "!Could not read file\n";
+      return write_all(conn->fd, message, strlen(message));
+    }
+
+    char *text;
+    size_t text_length;
+    FILE *mem = open_memstream(&text, &text_length);
+    if (mem == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+    print_lines(mem, conn->buffer, num_bytes, pos, line_length);
+    fclose(mem);
+    bool sent = send_frame(conn->fd, text, text_length);
+    free(text);
+    if (!sent) {
+      return false;
+    }
+  }
+  return write_all(conn->fd, "0\n", 2);
+}
+
+static void *serve_connection(void *arg) {
+  Connection *conn = (Connection *)arg;
+  FILE *in = fdopen(conn->fd, "r");
+  if (in == NULL) {
+    close(conn->fd);
+    free(conn);
+    return NULL;
+  }
+
+  char *line = NULL;
+  size_t capacity = 0;
+  bool connected = true;
+  while (connected && getline(&line, &capacity, in) >= 0) {
+    char *path;
+    uint64_t offset;
+    int64_t length;
+    int line_length = conn->line_length;
+    int found = parse_job_line(line, &path, &offset, &length, &line_length);
+    if (found == 0) {
+      continue;
+    }
+    if (found < 0) {
+      connected = write_all(conn->fd, "!Invalid request\n", 17);
+      continue;
+    }
+
+    OpenFile *file = file_cache_acquire(conn->cache, path);
+    if (file == NULL) {
+      char message[128];
+      int message_length =
+          snprintf(message, sizeof(message), "!Could not open file: %s\n",
+                   strerror(errno));
+      connected = write_all(conn->fd, message, message_length);
+      continue;
+    }
+    connected = send_range(conn, file, offset, length, line_length);
+    file_cache_release(conn->cache, file);
+  }
+
+  free(line);
+  fclose(in);
+  free(conn->buffer);
+  free(conn);
+  return NULL;
+}
+
+void serve(const char *socket_path, int line_length, int max_files) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Error: Socket path '%s' is too long\n", socket_path);
+    exit(1);
+  }
+  strcpy(address.sun_path, socket_path);
+
+  // Replace the socket left behind by a previous server.
+  struct stat st;
+  if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(socket_path);
+  }
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 ||
+      bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    fprintf(stderr, "Error: Could not listen on '%s'\n", socket_path);
+    exit(1);
+  }
+
+  // A client that disconnects mid-response must not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  FileCache cache;
+  file_cache_init(&cache, max_files);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while (true) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE ||
+          errno == ENFILE) {
+        continue;
+      }
+      fprintf(stderr, "Error: Could not accept connection\n");
+      exit(1);
+    }
+
+    Connection *conn = malloc(sizeof(Connection));
+    if (conn == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+    *conn = (Connection){&cache, line_length, fd, NULL, 0};
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, serve_connection, conn) != 0) {
+      close(fd);
+      free(conn);
+    }
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef serve_h
+#define serve_h
+
+// Listens on a Unix domain socket at socket_path and answers dump requests
+// until killed. Each connection may send any number of requests, one per
+// line, in the job form used by --batch:
+//
+//   <path> <offset> <length> [<line_length>]
+//
+// The response is the formatted text in frames of `<n>\n` followed by n
+// bytes, ending with an empty frame `0\n`, or a single `!<message>\n` line
+// if the request cannot be answered. A file that is truncated or cannot be
+// read partway through ends the response with a `!` line in place of the
+// next frame. Input is read with pread rather than mapped, so a file that
+// shrinks under a request cannot crash the server. Up to `max_files` input
+// files are kept open between requests, least recently used first out.
+// Exits with an error message if the socket cannot be set up.
+void serve(const char *socket_path, int line_length, int max_files);
+
+#endif
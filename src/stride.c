@@ -0,0 +1,181 @@
+#include "stride.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Candidates listed in the report.
+#define STRIDE_REPORT 5
+
+// A stride must stand out from its neighbours by this fraction of matching
+// bytes to be suggested.
+#define STRIDE_MIN_PEAK 0.01
+
+typedef struct {
+  const uint8_t *data;
+  size_t length;
+  int max_stride;
+  uint64_t *matches;
+  int next;
+} StrideJob;
+
+// Counts the positions i for which data[i] == data[i + stride]. Compares
+// eight bytes at a time: the XOR of two words has a zero byte wherever they
+// match, and the zero bytes are found and counted with a few word
+// operations.
+static uint64_t count_matches(const uint8_t *data, size_t length,
+                              int stride) {
+  const uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+  size_t n = length - stride;
+  uint64_t matches = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t a, b;
+    memcpy(&a, data + i, 8);
+    memcpy(&b, data + i + stride, 8);
+    uint64_t x = a ^ b;
+    uint64_t zero = ~(((x & low7) + low7) | x | low7);
+    matches += __builtin_popcountll(zero);
+  }
+  for (; i < n; i++) {
+    matches += data[i] == data[i + stride];
+  }
+  return matches;
+}
+
+static void *stride_worker(void *arg) {
+  StrideJob *job = (StrideJob *)arg;
+  while (true) {
+    int stride = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+    if (stride > job->max_stride + 1) {
+      break;
+    }
+    job->matches[stride] = count_matches(job->data, job->length, stride);
+  }
+  return NULL;
+}
+
+// Fills matches[1..max_stride + 1] on up to `threads` threads.
+static void count_all(const uint8_t *data, size_t length, int max_stride,
+                      uint64_t *matches, int threads) {
+  StrideJob job = {data, length, max_stride, matches, 1};
+  threads = threads < max_stride ? threads : max_stride;
+  if (threads <= 1) {
+    stride_worker(&job);
+    return;
+  }
+
+  pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+  if (workers == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&workers[i], NULL, stride_worker, &job) != 0) {
+      fprintf(stderr, "Error: Could not start worker thread\n");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+}
+
+int detect_stride(FILE *out, FILE *file, int64_t bytes_to_read,
+                  int max_stride, int threads) {
+  size_t wanted = STRIDE_SAMPLE_SIZE;
+  if (bytes_to_read >= 0 && (uint64_t)bytes_to_read < wanted) {
+    wanted = bytes_to_read;
+  }
+  uint8_t *data = malloc(wanted > 0 ? wanted : 1);
+  if (data == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  size_t length = 0;
+  while (length < wanted) {
+    size_t got = fread(data + length, 1, wanted - length, file);
+    if (got == 0) {
+      break;
+    }
+    length += got;
+  }
+
+  // Every stride needs a neighbour on each side and some bytes to compare.
+  if ((size_t)max_stride + 2 > length / 2) {
+    max_stride = length / 2 > 2 ? (int)(length / 2) - 2 : 0;
+  }
+  if (max_stride < 2) {
+    fprintf(out, "Not enough input to detect a record length\n");
+    free(data);
+    return 0;
+  }
+
+  uint64_t *matches = calloc(max_stride + 2, sizeof(uint64_t));
+  double *rate = calloc(max_stride + 2, sizeof(double));
+  double *peak = calloc(max_stride + 2, sizeof(double));
+  if (matches == NULL || rate == NULL || peak == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  count_all(data, length, max_stride, matches, threads);
+
+  // A record length shows as a stride whose bytes match more often than at
+  // the strides just before and after it.
+  for (int s = 1; s <= max_stride + 1; s++) {
+    rate[s] = (double)matches[s] / (length - s);
+  }
+  int best = 0;
+  for (int s = 2; s <= max_stride; s++) {
+    peak[s] = rate[s] - (rate[s - 1] + rate[s + 1]) / 2;
+    if (best == 0 || peak[s] > peak[best]) {
+      best = s;
+    }
+  }
+
+  // Multiples of the record length stand out too, so prefer the smallest
+  // divisor of the best stride that stands out nearly as much.
+  int suggested = 0;
+  if (peak[best] >= STRIDE_MIN_PEAK) {
+    suggested = best;
+    for (int d = 2; d < best; d++) {
+      if (best % d == 0 && peak[d] >= peak[best] / 2) {
+        suggested = d;
+        break;
+      }
+    }
+  }
+
+  fprintf(out, "Stride  Matching     Peak\n");
+  bool *listed = calloc(max_stride + 2, sizeof(bool));
+  if (listed == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+  for (int n = 0; n < STRIDE_REPORT && n < max_stride - 1; n++) {
+    int top = 0;
+    for (int s = 2; s <= max_stride; s++) {
+      if (!listed[s] && (top == 0 || peak[s] > peak[top])) {
+        top = s;
+      }
+    }
+    listed[top] = true;
+    fprintf(out, "%6d  %7.2f%%  %+6.2f%%\n", top, 100 * rate[top],
+            100 * peak[top]);
+  }
+  if (suggested > 0) {
+    fprintf(out, "Suggested line length: %d (-l %d)\n", suggested, suggested);
+  } else {
+    fprintf(out, "No dominant record length found\n");
+  }
+
+  free(listed);
+  free(peak);
+  free(rate);
+  free(matches);
+  free(data);
+  return suggested;
+}
@@ -0,0 +1,21 @@
+#ifndef stride_h
+#define stride_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Bytes of input examined when looking for a record length.
+#define STRIDE_SAMPLE_SIZE (4 << 20)
+
+// Estimates the dominant record length of the input from its current
+// position by autocorrelation: for every stride up to max_stride, counts how
+// often a byte equals the byte `stride` positions later, on `threads`
+// threads. Strides that stand out from their neighbours are reported to
+// `out`, best first, and the smallest stride of which the best is a multiple
+// and that stands out nearly as much is suggested as a line length. Reads
+// at most bytes_to_read bytes if it is not negative, and never more than
+// STRIDE_SAMPLE_SIZE. Returns the suggested stride, or 0 if none stands out.
+int detect_stride(FILE *out, FILE *file, int64_t bytes_to_read,
+                  int max_stride, int threads);
+
+#endif
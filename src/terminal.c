@@ -0,0 +1,64 @@
+#include "terminal.h"
+#include <signal.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+volatile sig_atomic_t terminal_resized = 0;
+
+int terminal_columns(int fd) {
+  struct winsize size;
+  if (!isatty(fd) || ioctl(fd, TIOCGWINSZ, &size) != 0) {
+    return 0;
+  }
+  return size.ws_col;
+}
+
+// Width of a line of `panes` dumps: `offsets` offset columns, then for each
+// pane the units, each after a space and with another space between groups
+// of 4 bytes if the units are smaller, the bar and the ASCII column, with two
+// spaces between panes.
+static int panes_width(int line_length, int panes, int offsets, Radix radix,
+                       int group) {
+  int units = (line_length + group - 1) / group;
+  int pane = units * (1 + unit_width(radix, group)) + 3 + line_length;
+  if (group < 4) {
+    pane += (line_length - 1) / 4;
+  }
+  return 9 * offsets + panes * pane + 2 * (panes - 1);
+}
+
+int fit_line_length(int columns, int panes, int offsets, Radix radix,
+                    int group) {
+  int step = group > 4 ? group : 4;
+  int line_length = step;
+  while (panes_width(line_length + step, panes, offsets, radix, group) <=
+         columns) {
+    line_length += step;
+  }
+  return line_length;
+}
+
+int fit_dump_line_length(int columns) {
+  int line_length = fit_line_length(columns, 1, 1, current_radix(),
+                                    current_group());
+  for (int length = line_length; length > 0; length -= 4) {
+    if (is_unrolled_length(length)) {
+      return length;
+    }
+  }
+  return line_length;
+}
+
+static void on_resize(int signal) {
+  (void)signal;
+  terminal_resized = 1;
+}
+
+void watch_terminal_width(void) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_resize;
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGWINCH, &action, NULL);
+}
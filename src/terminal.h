@@ -0,0 +1,30 @@
+#ifndef terminal_h
+#define terminal_h
+
+#include "format.h"
+#include <signal.h>
+
+// Set when the terminal is resized after watch_terminal_width() was called.
+// Whoever acts on a resize clears it again.
+extern volatile sig_atomic_t terminal_resized;
+
+// Returns the width in columns of the terminal on fd, or 0 if fd is not a
+// terminal.
+int terminal_columns(int fd);
+
+// Returns the largest line length, a multiple of 4 and of `group`, for which
+// `panes` dumps printed side by side with `offsets` offset columns fit in the
+// given number of columns, when their units are `group` bytes in `radix`.
+// Never returns less than one such multiple.
+int fit_line_length(int columns, int panes, int offsets, Radix radix,
+                    int group);
+
+// Returns the line length for a dump in the current layout that fits in the
+// given number of columns. The longest length with an unrolled formatter is
+// preferred over a longer one without.
+int fit_dump_line_length(int columns);
+
+// Starts setting terminal_resized whenever a SIGWINCH arrives.
+void watch_terminal_width(void);
+
+#endif
@@ -0,0 +1,289 @@
+#include "vote.h"
+#include "diff.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes read from each replica per step. While the main thread compares one
+// block, every replica's reader thread is already filling the next one, so a
+// pass over N replicas costs about as much as reading the slowest of them.
+#define VOTE_BLOCK_SIZE (1 << 20)
+
+// Value used for a byte position past the end of a replica.
+#define VOTE_ABSENT 256
+
+typedef struct {
+  FILE **files;
+  char **names;
+  int count;
+  int line_length;
+  size_t block_size;
+  int64_t bytes_to_read;
+
+  // Double-buffered blocks: replica i of slot s starts at
+  // buffers[s] + i * block_size and holds lengths[s][i] bytes.
+  uint8_t *buffers[2];
+  size_t *lengths[2];
+
+  pthread_barrier_t filled;
+  pthread_barrier_t decided;
+  bool stop;
+
+  uint64_t *mismatches;
+  long long ties;
+  long long lines;
+} Vote;
+
+typedef struct {
+  Vote *vote;
+  int index;
+} Reader;
+
+static void *reader_main(void *arg) {
+  Reader *reader = (Reader *)arg;
+  Vote *vote = reader->vote;
+  int i = reader->index;
+
+  for (uint64_t step = 0;; step++) {
+    int slot = step & 1;
+    size_t want = vote->block_size;
+    if (vote->bytes_to_read >= 0) {
+      uint64_t done = step * vote->block_size;
+      uint64_t total = vote->bytes_to_read;
+      want = done >= total ? 0
+             : total - done < want ? total - done
+                                   : want;
+    }
+    uint8_t *buffer = vote->buffers[slot] + i * vote->block_size;
+    vote->lengths[slot][i] = want ? fread(buffer, 1, want, vote->files[i]) : 0;
+
+    pthread_barrier_wait(&vote->filled);
+    pthread_barrier_wait(&vote->decided);
+    if (vote->stop) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Returns the byte at pos in replica i, or VOTE_ABSENT past its end.
+static inline int replica_byte(Vote *vote, int slot, int i, size_t pos) {
+  if (pos >= vote->lengths[slot][i]) {
+    return VOTE_ABSENT;
+  }
+  return vote->buffers[slot][i * vote->block_size + pos];
+}
+
+// Works out the majority value of each byte in the line starting at pos.
+// Where no value holds a majority, the most common one is stored and the
+// byte is marked as tied. Returns the length of the majority line.
+static int vote_line(Vote *vote, int slot, size_t pos, uint8_t *majority,
+                     bool *tied) {
+  int majority_length = 0;
+  for (int j = 0; j < vote->line_length; j++) {
+    int best_value = VOTE_ABSENT;
+    int best_votes = 0;
+    for (int i = 0; i < vote->count; i++) {
+      int value = replica_byte(vote, slot, i, pos + j);
+      int votes = 0;
+      for (int k = 0; k < vote->count; k++) {
+        votes += replica_byte(vote, slot, k, pos + j) == value;
+      }
+      if (votes > best_votes) {
+        best_value = value;
+        best_votes = votes;
+      }
+    }
+    if (best_value == VOTE_ABSENT) {
+      break;
+    }
+    tied[j] = best_votes * 2 <= vote->count;
+    vote->ties += tied[j];
+    majority[j] = (uint8_t)best_value;
+    majority_length = j + 1;
+  }
+  return majority_length;
+}
+
+static int replica_line_length(Vote *vote, int slot, int i, size_t pos) {
+  size_t length = vote->lengths[slot][i];
+  if (pos >= length) {
+    return 0;
+  }
+  return length - pos < (size_t)vote->line_length ? (int)(length - pos)
+                                                  : vote->line_length;
+}
+
+// Reports the lines of a block where the replicas differ. A tied byte has no
+// majority to agree with, so it counts as differing in every replica.
+static void compare_block(Vote *vote, int slot, uint64_t offset,
+                          uint8_t *majority, bool *tied, uint8_t *reference) {
+  size_t *lengths = vote->lengths[slot];
+  size_t block_length = 0;
+  bool all_equal = true;
+  for (int i = 0; i < vote->count; i++) {
+    block_length = lengths[i] > block_length ? lengths[i] : block_length;
+    if (lengths[i] != lengths[0] ||
+        memcmp(vote->buffers[slot] + i * vote->block_size,
+               vote->buffers[slot], lengths[0]) != 0) {
+      all_equal = false;
+    }
+  }
+  if (all_equal) {
+    return;
+  }
+
+  for (size_t pos = 0; pos < block_length; pos += vote->line_length) {
+    uint8_t *first = vote->buffers[slot] + pos;
+    int first_length = replica_line_length(vote, slot, 0, pos);
+    bool line_equal = true;
+    for (int i = 1; i < vote->count && line_equal; i++) {
+      uint8_t *line = vote->buffers[slot] + i * vote->block_size + pos;
+      line_equal = replica_line_length(vote, slot, i, pos) == first_length &&
+                   memcmp(line, first, first_length) == 0;
+    }
+    if (line_equal) {
+      continue;
+    }
+
+    vote->lines++;
+    int majority_length = vote_line(vote, slot, pos, majority, tied);
+    bool any_tied = false;
+    for (int j = 0; j < majority_length; j++) {
+      any_tied = any_tied || tied[j];
+    }
+    printf("\033[0;33m%08llx\033[0m ", (unsigned long long)(offset + pos));
+    print_diff_side(majority, majority_length, majority, majority_length,
+                    vote->line_length);
+    printf("  %s\n", any_tied ? "no majority" : "majority");
+
+    for (int i = 0; i < vote->count; i++) {
+      uint8_t *line = vote->buffers[slot] + i * vote->block_size + pos;
+      int length = replica_line_length(vote, slot, i, pos);
+      int differing = 0;
+      for (int j = 0; j < vote->line_length; j++) {
+        bool in_line = j < length;
+        bool in_majority = j < majority_length;
+        // Make tied bytes differ from the reference so they are highlighted.
+        if (in_majority) {
+          reference[j] = tied[j] && in_line ? line[j] ^ 1 : majority[j];
+        }
+        if (in_line != in_majority ||
+            (in_line && (tied[j] || line[j] != majority[j]))) {
+          differing++;
+        }
+      }
+      if (differing == 0) {
+        continue;
+      }
+      vote->mismatches[i] += differing;
+      printf("%9s", "");
+      print_diff_side(line, length, reference, majority_length,
+                      vote->line_length);
+      printf("  %s\n", vote->names[i]);
+    }
+  }
+}
+
+long long vote_files(FILE **files, char **names, int count, uint64_t offset,
+                     int64_t bytes_to_read, int line_length) {
+  size_t block_size = VOTE_BLOCK_SIZE - VOTE_BLOCK_SIZE % line_length;
+  if (block_size == 0) {
+    block_size = line_length;
+  }
+
+  Vote vote = {
+      .files = files,
+      .names = names,
+      .count = count,
+      .line_length = line_length,
+      .block_size = block_size,
+      .bytes_to_read = bytes_to_read,
+      .stop = false,
+      .ties = 0,
+      .lines = 0,
+  };
+  uint8_t *majority = malloc(line_length);
+  uint8_t *reference = malloc(line_length);
+  bool *tied = malloc(sizeof(bool) * line_length);
+  vote.mismatches = calloc(count, sizeof(uint64_t));
+  for (int s = 0; s < 2; s++) {
+    vote.buffers[s] = malloc(block_size * count);
+    vote.lengths[s] = calloc(count, sizeof(size_t));
+    if (vote.buffers[s] == NULL || vote.lengths[s] == NULL) {
+      fprintf(stderr, "Error: Insufficient Memory \n");
+      exit(1);
+    }
+  }
+  if (majority == NULL || reference == NULL || tied == NULL ||
+      vote.mismatches == NULL) {
+    fprintf(stderr, "Error: Insufficient Memory \n");
+    exit(1);
+  }
+
+  pthread_barrier_init(&vote.filled, NULL, count + 1);
+  pthread_barrier_init(&vote.decided, NULL, count + 1);
+
+  pthread_t *threads = malloc(sizeof(pthread_t) * count);
+  Reader *readers = malloc(sizeof(Reader) * count);
+  for (int i = 0; i < count; i++) {
+    readers[i] = (Reader){&vote, i};
+    if (pthread_create(&threads[i], NULL, reader_main, &readers[i]) != 0) {
+      fprintf(stderr, "Error: Could not start reader thread\n");
+      exit(1);
+    }
+  }
+
+  // Step n: the readers fill block n while block n - 1 is compared here.
+  for (uint64_t step = 0;; step++) {
+    if (step > 0) {
+      compare_block(&vote, (step - 1) & 1, offset + (step - 1) * block_size,
+                    majority, tied, reference);
+    }
+
+    pthread_barrier_wait(&vote.filled);
+    vote.stop = true;
+    for (int i = 0; i < count; i++) {
+      if (vote.lengths[step & 1][i] > 0) {
+        vote.stop = false;
+      }
+    }
+    pthread_barrier_wait(&vote.decided);
+    if (vote.stop) {
+      break;
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (vote.mismatches[i] > 0) {
+      printf("'%s': %llu %s from the majority\n", names[i],
+             (unsigned long long)vote.mismatches[i],
+             vote.mismatches[i] == 1 ? "byte differs" : "bytes differ");
+    }
+  }
+  if (vote.ties > 0) {
+    printf("%lld %s no majority value\n", vote.ties,
+           vote.ties == 1 ? "byte has" : "bytes have");
+  }
+
+  pthread_barrier_destroy(&vote.filled);
+  pthread_barrier_destroy(&vote.decided);
+  for (int s = 0; s < 2; s++) {
+    free(vote.buffers[s]);
+    free(vote.lengths[s]);
+  }
+  free(vote.mismatches);
+  free(majority);
+  free(reference);
+  free(tied);
+  free(threads);
+  free(readers);
+  return vote.lines;
+}
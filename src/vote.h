@@ -0,0 +1,14 @@
+#ifndef vote_h
+#define vote_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Compares `count` replicas of the same data in a single pass, reading them
+// in parallel, and prints every line where they disagree together with the
+// majority value of each byte. A negative bytes_to_read compares until every
+// replica ends. Returns the number of disagreeing lines.
+long long vote_files(FILE **files, char **names, int count, uint64_t offset,
+                     int64_t bytes_to_read, int line_length);
+
+#endif